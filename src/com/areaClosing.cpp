@@ -0,0 +1,54 @@
+
+#include "../common.h"
+#include "../tpConnectedComponents.h"
+#include "CLI11.hpp"
+
+using namespace cv;
+using namespace std;
+
+int main( int argc, char** argv )
+{
+    CLI::App app{"Area closing"};
+
+    string inputImage = "camera.png";
+    app.add_option("-I,--inputImage", inputImage, "Input image filename");
+
+    string outputImage = "out.png";
+    app.add_option("-O,--outputImage", outputImage, "Output image filename");
+
+    int areaThreshold = 50;
+    app.add_option("-F,--areaThreshold", areaThreshold, "Smallest area of the dark components kept")->required();
+
+    bool showImages = false;
+    app.add_flag("-S,--show", showImages, "Display input and output images in new windows");
+
+    int connectivity = 4;
+    app.add_option("-C,--connectivity", connectivity, "Connectivity of the components (4 or 8)");
+
+    int threads = -1;
+    app.add_option("-j,--threads", threads, "Number of threads (default: all the cores)");
+
+    CLI11_PARSE(app, argc, argv);
+    setNumThreads(threads);
+
+    if(connectivity != CONNECTIVITY_4 && connectivity != CONNECTIVITY_8)
+    {
+        std::cerr << "Connectivity unknown:" << connectivity << std::endl;
+        exit(1);
+    }
+
+    Mat image = imreadHelper(inputImage);
+    Mat res_image = areaClosing(image, areaThreshold, (Connectivity)connectivity);
+    imwriteHelper(res_image, outputImage);
+
+    // maybe show result
+    if (showImages) {
+        showimage(image, "Input Image");
+        showimage(res_image, "Output Image");
+        waitKey(0);
+        destroyAllWindows();
+    }
+
+    return 0;
+}
+
@@ -0,0 +1,288 @@
+#include <map>
+#include <iostream>
+#include <iomanip>
+#include <functional>
+#include "../common.h"
+#include "../tpConvolution.h"
+#include "../tpMorphology.h"
+#include "../tpConnectedComponents.h"
+#include "../tpHistogram.h"
+#include "CLI11.hpp"
+
+using namespace cv;
+using namespace std;
+
+
+/* FOREGROUND */
+#define RST  "\x1B[0m"
+#define KCYN  "\x1B[36m"
+#define BOLD "\x1B[1m"
+
+
+/**
+    Mean running time in milliseconds of f over the given number of repetitions.
+*/
+double timeIt(std::function<void()> f, int repetitions)
+{
+    int64 start = getTickCount();
+    for(int i = 0; i < repetitions; i++)
+        f();
+    int64 end = getTickCount();
+    return (end - start) * 1000.0 / getTickFrequency() / repetitions;
+}
+
+void printTiming(string parameter, double milliseconds)
+{
+    cout << "\t" << setw(24) << left << parameter << fixed << setprecision(3) << milliseconds << " ms" << endl;
+}
+
+/**
+    Point operators on the float input image and on the image converted to unsigned char,
+    alone then chained, as separate passes or in a single one.
+*/
+void benchPointOperators(Mat image, int repetitions)
+{
+    Mat image8;
+    image.convertTo(image8, CV_8UC1, 255);
+    for(Mat input : {image, image8})
+    {
+        string suffix = (input.type() == CV_8UC1) ? " (8 bits)" : "";
+        printTiming("inverse" + suffix, timeIt([&](){ inverse(input); }, repetitions));
+        printTiming("threshold" + suffix, timeIt([&](){ threshold(input, 0.2f, 0.8f); }, repetitions));
+        printTiming("quantize -Q 16" + suffix, timeIt([&](){ quantize(input, 16); }, repetitions));
+        printTiming("normalize" + suffix, timeIt([&](){ normalize(input, 0.1f, 0.9f); }, repetitions));
+        printTiming("chained" + suffix, timeIt([&](){
+            inverse(threshold(quantize(normalize(input, 0, 1), 16), 0.2f, 0.8f));
+        }, repetitions));
+        printTiming("PointPipeline" + suffix, timeIt([&](){
+            PointPipeline(input).normalize().quantize(16).threshold(0.2f, 0.8f).inverse().apply();
+        }, repetitions));
+    }
+}
+
+/**
+    Histogram based operators on the input image converted to unsigned char, the equalization
+    of the image converted to unsigned short, and the float equalization and local thresholds
+    of the float image. The time of the local equalization should not depend on the number
+    of tiles (-T), hence on their size, nor the one of the local threshold on its window
+    size (-K).
+*/
+void benchHistogram(Mat image, int repetitions)
+{
+    Mat image8;
+    image.convertTo(image8, CV_8UC1, 255);
+    printTiming("equalize", timeIt([&](){ equalize(image8); }, repetitions));
+    Mat image16;
+    image.convertTo(image16, CV_16UC1, 65535);
+    printTiming("equalize 16 bit", timeIt([&](){ equalize(image16); }, repetitions));
+    printTiming("equalize float -B 4096", timeIt([&](){ equalize(image, 4096); }, repetitions));
+    for(int tiles = 2; tiles <= 32; tiles *= 2)
+        printTiming("equalizeLocal -T " + to_string(tiles), timeIt([&](){ equalizeLocal(image8, tiles); }, repetitions));
+    printTiming("thresholdOtsu", timeIt([&](){ thresholdOtsu(image8); }, repetitions));
+    for(int k = 1; k <= 64; k *= 4)
+        printTiming("thresholdLocal -K " + to_string(k), timeIt([&](){ thresholdLocal(image, k, 0.5f); }, repetitions));
+}
+
+/**
+    Mean filter with a window radius (-M) sweeping from 1 to 64:
+    the running time is expected to be the same for every radius.
+*/
+void benchMeanFilter(Mat image, int repetitions)
+{
+    for(int k = 1; k <= 64; k *= 2)
+        printTiming("-M " + to_string(k), timeIt([&](){ meanFilter(image, k); }, repetitions));
+}
+
+/**
+    Convolution by random (full rank) kernels of growing size with every backend.
+    The "fft cached" timing reuses the Fourier transform of the image (see FFTConvolution).
+*/
+void benchConvolution(Mat image, int repetitions)
+{
+    for(int k = 3; k <= 31; k = 2 * k + 1)
+    {
+        Mat kernel(k, k, CV_32FC1);
+        randu(kernel, 0, 1);
+        kernel = kernel / sum(kernel)[0];
+
+        cout << "\t-K " << k << "x" << k << endl;
+        printTiming("auto", timeIt([&](){ convolution(image, kernel, CONVOLUTION_AUTO); }, repetitions));
+        printTiming("direct", timeIt([&](){ convolution(image, kernel, CONVOLUTION_DIRECT); }, repetitions));
+        printTiming("separable", timeIt([&](){ convolution(image, kernel, CONVOLUTION_SEPARABLE); }, repetitions));
+        printTiming("fft", timeIt([&](){ convolution(image, kernel, CONVOLUTION_FFT); }, repetitions));
+        FFTConvolution cached(image);
+        cached.apply(kernel);
+        printTiming("fft cached", timeIt([&](){ cached.apply(kernel); }, repetitions));
+    }
+}
+
+void benchEdgeSobel(Mat image, int repetitions)
+{
+    printTiming("", timeIt([&](){ edgeSobel(image); }, repetitions));
+}
+
+/**
+    Bilateral filter with gaussian spatial kernels of growing size, in exact and grid modes:
+    the running time of the grid mode should not depend on the kernel size.
+*/
+void benchBilateralFilter(Mat image, int repetitions)
+{
+    for(int k = 5; k <= 31; k = 2 * k + 1)
+    {
+        Mat kernel(k, k, CV_32FC1);
+        float sigma = k / 4.0f;
+        for(int y = 0; y < k; y++)
+            for(int x = 0; x < k; x++)
+                kernel.at<float>(y, x) = exp(-((y - k / 2) * (y - k / 2) + (x - k / 2) * (x - k / 2)) / (2 * sigma * sigma));
+        kernel = kernel / sum(kernel)[0];
+
+        cout << "\t-K " << k << "x" << k << endl;
+        printTiming("exact", timeIt([&](){ bilateralFilter(image, kernel, 0.1f, BILATERAL_EXACT); }, repetitions));
+        printTiming("grid", timeIt([&](){ bilateralFilter(image, kernel, 0.1f, BILATERAL_GRID); }, repetitions));
+    }
+}
+
+/**
+    Median filter with a window radius (-M) sweeping from 1 to 32: 8 bit images
+    use sliding histograms and the running time should not depend on the radius.
+*/
+void benchMedian(Mat image, int repetitions)
+{
+    for(int k = 1; k <= 32; k *= 2)
+        printTiming("-M " + to_string(k), timeIt([&](){ median(image, k); }, repetitions));
+}
+
+void benchErode(Mat image, int repetitions)
+{
+    for(string name : {"morphoCircle.png", "morphoDisk25.png", "morphoLineV.png", "morphoLineV51.png"})
+    {
+        Mat structuringElement = imreadHelper(name);
+        printTiming("-E " + name, timeIt([&](){ erode(image, structuringElement); }, repetitions));
+    }
+}
+
+void benchOpen(Mat image, int repetitions)
+{
+    for(string name : {"morphoCircle.png", "morphoDisk25.png", "morphoLineV51.png"})
+    {
+        Mat structuringElement = imreadHelper(name);
+        printTiming("-E " + name, timeIt([&](){ open(image, structuringElement); }, repetitions));
+    }
+}
+
+void benchMorphologicalGradient(Mat image, int repetitions)
+{
+    for(string name : {"morphoCircle.png", "morphoDisk25.png", "morphoLineV51.png"})
+    {
+        Mat structuringElement = imreadHelper(name);
+        printTiming("-E " + name, timeIt([&](){ morphologicalGradient(image, structuringElement); }, repetitions));
+    }
+}
+
+/**
+    Connected component labeling of the input image thresholded at 1/2, and of its
+    λ-connected components.
+*/
+void benchLabeling(Mat image, int repetitions)
+{
+    Mat binary = image.clone();
+    binary.forEach<float>([](float & pix, const int *) {
+        pix = (pix > 0.5f) ? 1.0f : 0.0f;
+    });
+    printTiming("ccLabel", timeIt([&](){ ccLabel(binary); }, repetitions));
+    printTiming("ccLabel2pass", timeIt([&](){ ccLabel2pass(binary); }, repetitions));
+    printTiming("ccLabelLambda 0.02", timeIt([&](){ ccLabelLambda(image, 0.02f); }, repetitions));
+    printTiming("detectRectangle", timeIt([&](){ detectRectangle(binary); }, repetitions));
+    printTiming("ccLabelRuns", timeIt([&](){ ccLabelRuns(binary); }, repetitions));
+    printTiming("ccLabelRuns + toImage", timeIt([&](){ ccLabelRuns(binary).toImage(); }, repetitions));
+    printTiming("StreamingLabeler", timeIt([&](){
+        StreamingLabeler labeler(binary.cols, [](const ComponentStats &) {});
+        for(int y = 0; y < binary.rows; y++)
+            labeler.addRow(binary.ptr<float>(y));
+        labeler.finish();
+    }, repetitions));
+
+    // stroke of 16x3 pixels painted then erased at the center of the image
+    DynamicLabeling dynamic(binary);
+    vector<Point> stroke;
+    for(int y = 0; y < 3; y++)
+        for(int x = 0; x < 16; x++)
+            stroke.push_back(Point(binary.cols / 2 + x, binary.rows / 2 + y));
+    printTiming("DynamicLabeling stroke", timeIt([&](){
+        dynamic.update(stroke, true);
+        dynamic.update(stroke, false);
+    }, repetitions));
+}
+
+/**
+    Area opening through a component tree built once, then filtered for growing sizes
+    (-F): each filtering should take the same time, much less than building the tree.
+    Trees of 8 bit data are sorted in one counting pass: the scaled image, no longer
+    holding 8 bit data, takes the 4 pass radix sort of floats.
+*/
+void benchAreaOpening(Mat image, int repetitions)
+{
+    Mat scaled = image * 0.999f;
+    printTiming("ComponentTree", timeIt([&](){ ComponentTree tree(image); }, repetitions));
+    printTiming("ComponentTree float", timeIt([&](){ ComponentTree tree(scaled); }, repetitions));
+    ComponentTree tree(image);
+    for(int size = 1; size <= 10000; size *= 10)
+        printTiming("areaFilter -F " + to_string(size), timeIt([&](){ tree.areaFilter(size); }, repetitions));
+}
+
+
+int main( int argc, char** argv )
+{
+    map<string, std::function<void(Mat, int)>> p;
+    p["histogram"] = benchHistogram;
+    p["pointOperators"] = benchPointOperators;
+    p["meanFilter"] = benchMeanFilter;
+    p["convolution"] = benchConvolution;
+    p["edgeSobel"] = benchEdgeSobel;
+    p["bilateralFilter"] = benchBilateralFilter;
+    p["median"] = benchMedian;
+    p["erode"] = benchErode;
+    p["open"] = benchOpen;
+    p["morphologicalGradient"] = benchMorphologicalGradient;
+    p["ccLabel"] = benchLabeling;
+    p["areaOpening"] = benchAreaOpening;
+
+    CLI::App app{"Benchmark program"};
+
+    string program = "";
+    app.add_option("-P,--program", program, "Command to benchmark");
+
+    string inputImage = "camera.png";
+    app.add_option("-I,--inputImage", inputImage, "Input image filename");
+
+    int repetitions = 5;
+    app.add_option("-R,--repetitions", repetitions, "Number of runs averaged for each timing");
+
+    int threads = -1;
+    app.add_option("-j,--threads", threads, "Number of threads (default: all the cores)");
+
+    CLI11_PARSE(app, argc, argv);
+    setNumThreads(threads);
+
+    Mat image = imreadHelper(inputImage);
+    cout << "Image " << inputImage << ": " << image.cols << "x" << image.rows << " pixels" << endl;
+
+    if(program.size() != 0)
+    {
+        if (!p.count(program))
+        {
+            cerr << "Unknown program " << program << endl;
+            exit(1);
+        }
+        cout << KCYN << BOLD << program << RST << endl;
+        p[program](image, repetitions);
+    }else{
+        for(auto iter = p.begin(); iter != p.end(); ++iter)
+        {
+            cout << KCYN << BOLD << iter->first << RST << endl;
+            iter->second(image, repetitions);
+        }
+    }
+
+    return 0;
+}
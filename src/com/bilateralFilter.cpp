@@ -25,14 +25,32 @@ int main( int argc, char** argv )
     float intensityScale = 0.1f;
     app.add_option("-C,--intensityScale", intensityScale, "Intensity scale (Gaussian standard deviation)")->required();
 
+    string modeName = "exact";
+    app.add_option("-M,--mode", modeName, "Bilateral filter algorithm ('exact' or 'grid')");
+
+    int threads = -1;
+    app.add_option("-j,--threads", threads, "Number of threads (default: all the cores)");
+
     CLI11_PARSE(app, argc, argv);
+    setNumThreads(threads);
+
+    BilateralMode mode;
+    if(modeName.compare("exact")==0)
+        mode = BILATERAL_EXACT;
+    else if(modeName.compare("grid")==0)
+        mode = BILATERAL_GRID;
+    else
+    {
+        std::cerr << "Bilateral filter mode unknown:" << modeName << std::endl;
+        exit(1);
+    }
 
 
     Mat image = imreadHelper(inputImage);
     Mat kernel = imreadHelper(kernelImage);
     kernel = kernel / sum(kernel)[0];
 
-    Mat res_image = bilateralFilter(image, kernel, intensityScale);
+    Mat res_image = bilateralFilter(image, kernel, intensityScale, mode);
     imwriteHelper(res_image, outputImage);
 
 
@@ -22,10 +22,23 @@ int main( int argc, char** argv )
     bool showImages = false;
     app.add_flag("-S,--show", showImages, "Display input and output images in new windows");
 
+    int connectivity = 4;
+    app.add_option("-C,--connectivity", connectivity, "Connectivity of the components (4 or 8)");
+
+    int threads = -1;
+    app.add_option("-j,--threads", threads, "Number of threads (default: all the cores)");
+
     CLI11_PARSE(app, argc, argv);
+    setNumThreads(threads);
+
+    if(connectivity != CONNECTIVITY_4 && connectivity != CONNECTIVITY_8)
+    {
+        std::cerr << "Connectivity unknown:" << connectivity << std::endl;
+        exit(1);
+    }
 
     Mat image = imreadHelper(inputImage);
-    Mat res_image = ccAreaFilter(image, areaThreshold);
+    Mat res_image = ccAreaFilter(image, areaThreshold, (Connectivity)connectivity);
     imwriteHelper(res_image, outputImage);
 
     // maybe show result
@@ -20,10 +20,35 @@ int main( int argc, char** argv )
     bool showImages = false;
     app.add_flag("-S,--show", showImages, "Display input and output images in new windows");
 
+    int connectivity = 4;
+    app.add_option("-C,--connectivity", connectivity, "Connectivity of the components (4 or 8)");
+
+    bool runs = false;
+    app.add_flag("-R,--runs", runs, "Label the runs of present pixels (see ccLabelRuns)");
+
+    float lambda = -1;
+    app.add_option("-L,--lambda", lambda, "Label the lambda-connected components of a grayscale image: neighbours differing by at most lambda are linked (see ccLabelLambda)");
+
+    int threads = -1;
+    app.add_option("-j,--threads", threads, "Number of threads (default: all the cores)");
+
     CLI11_PARSE(app, argc, argv);
+    setNumThreads(threads);
+
+    if(connectivity != CONNECTIVITY_4 && connectivity != CONNECTIVITY_8)
+    {
+        std::cerr << "Connectivity unknown:" << connectivity << std::endl;
+        exit(1);
+    }
 
     Mat image = imreadHelper(inputImage);
-    Mat res_image = ccLabel(image);
+    Mat res_image;
+    if(lambda >= 0)
+        res_image = ccLabelLambda(image, lambda, (Connectivity)connectivity);
+    else if(runs)
+        res_image = ccLabelRuns(image, (Connectivity)connectivity).toImage();
+    else
+        res_image = ccLabel(image, (Connectivity)connectivity);
 
     Mat tmp = remap_labels(res_image);
     double min, max;
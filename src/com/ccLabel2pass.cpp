@@ -19,7 +19,11 @@ int main( int argc, char** argv )
     bool showImages = false;
     app.add_flag("-S,--show", showImages, "Display input and output images in new windows");
 
+    int threads = -1;
+    app.add_option("-j,--threads", threads, "Number of threads (default: all the cores)");
+
     CLI11_PARSE(app, argc, argv);
+    setNumThreads(threads);
 
     Mat image = imreadHelper(inputImage);
     Mat res_image = ccLabel2pass(image);
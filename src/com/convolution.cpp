@@ -22,14 +22,36 @@ int main( int argc, char** argv )
     string kernelImage = "maskGauss5x5.png";
     app.add_option("-K,--kernel", kernelImage, "Structuring element filename");
 
+    string backendName = "auto";
+    app.add_option("-B,--backend", backendName, "Convolution algorithm ('auto', 'direct', 'separable' or 'fft')");
+
+    int threads = -1;
+    app.add_option("-j,--threads", threads, "Number of threads (default: all the cores)");
+
     CLI11_PARSE(app, argc, argv);
+    setNumThreads(threads);
+
+    ConvolutionBackend backend;
+    if(backendName.compare("auto")==0)
+        backend = CONVOLUTION_AUTO;
+    else if(backendName.compare("direct")==0)
+        backend = CONVOLUTION_DIRECT;
+    else if(backendName.compare("separable")==0)
+        backend = CONVOLUTION_SEPARABLE;
+    else if(backendName.compare("fft")==0)
+        backend = CONVOLUTION_FFT;
+    else
+    {
+        std::cerr << "Convolution backend unknown:" << backendName << std::endl;
+        exit(1);
+    }
 
 
     Mat image = imreadHelper(inputImage);
     Mat kernel = imreadHelper(kernelImage);
     kernel = kernel / sum(kernel)[0];
 
-    Mat res_image = convolution(image, kernel);
+    Mat res_image = convolution(image, kernel, backend);
     imwriteHelper(res_image, outputImage);
 
 
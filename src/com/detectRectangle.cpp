@@ -0,0 +1,62 @@
+#include "../common.h"
+#include "../tpConnectedComponents.h"
+#include <iostream>
+#include "CLI11.hpp"
+
+using namespace cv;
+using namespace std;
+
+int main( int argc, char** argv )
+{
+    CLI::App app{"Rectangle detection"};
+
+    string inputImage = "cas1.png";
+    app.add_option("-I,--inputImage", inputImage, "Input image filename");
+
+    string outputImage = "out.png";
+    app.add_option("-O,--outputImage", outputImage, "Output image filename");
+
+    float tolerance = 0.1f;
+    app.add_option("-T,--tolerance", tolerance, "Largest fraction of the bounding box of a rectangle left empty");
+
+    bool printRectangles = false;
+    app.add_flag("-R,--rectangles", printRectangles, "Print the bounding boxes of the rectangles (x y width height)");
+
+    bool showImages = false;
+    app.add_flag("-S,--show", showImages, "Display input and output images in new windows");
+
+    int connectivity = 4;
+    app.add_option("-C,--connectivity", connectivity, "Connectivity of the components (4 or 8)");
+
+    int threads = -1;
+    app.add_option("-j,--threads", threads, "Number of threads (default: all the cores)");
+
+    CLI11_PARSE(app, argc, argv);
+    setNumThreads(threads);
+
+    if(connectivity != CONNECTIVITY_4 && connectivity != CONNECTIVITY_8)
+    {
+        std::cerr << "Connectivity unknown:" << connectivity << std::endl;
+        exit(1);
+    }
+
+    Mat image = imreadHelper(inputImage);
+    vector<Rect> rectangles;
+    Mat res_image = detectRectangle(image, rectangles, tolerance, (Connectivity)connectivity);
+    imwriteHelper(res_image, outputImage);
+
+    if (printRectangles) {
+        for (const Rect & r : rectangles)
+            cout << r.x << " " << r.y << " " << r.width << " " << r.height << endl;
+    }
+
+    // maybe show result
+    if (showImages) {
+        showimage(image, "Input Image");
+        showimage(res_image, "Output Image");
+        waitKey(0);
+        destroyAllWindows();
+    }
+
+    return 0;
+}
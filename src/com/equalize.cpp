@@ -19,10 +19,17 @@ int main( int argc, char** argv )
     bool showImages = false;
     app.add_flag("-S,--show", showImages, "Display input and output images in new windows");
 
+    int bins = 0;
+    app.add_option("-B,--bins", bins, "Equalize the float image with a histogram of the given number of bins (default: the 256 levels of the 8 bit image)");
+
+    int threads = -1;
+    app.add_option("-j,--threads", threads, "Number of threads (default: all the cores)");
+
     CLI11_PARSE(app, argc, argv);
+    setNumThreads(threads);
 
-    Mat image = imreadHelper(inputImage, false);
-    Mat res_image = equalize(image);
+    Mat image = imreadHelper(inputImage, bins > 0);
+    Mat res_image = (bins > 0) ? equalize(image, bins) : equalize(image);
     imwriteHelper(res_image, outputImage);
 
     // maybe show result
@@ -0,0 +1,48 @@
+
+#include "../common.h"
+#include "../tpHistogram.h"
+#include "CLI11.hpp"
+
+using namespace cv;
+using namespace std;
+
+int main( int argc, char** argv )
+{
+    CLI::App app{"Contrast limited adaptive histogram equalization"};
+
+    string inputImage = "camera_mauvaise_balance.png";
+    app.add_option("-I,--inputImage", inputImage, "Input image filename");
+
+    string outputImage = "out.png";
+    app.add_option("-O,--outputImage", outputImage, "Output image filename");
+
+    int tiles = 8;
+    app.add_option("-T,--tiles", tiles, "Number of tiles along each axis, equalized separately");
+
+    float clipLimit = 2.0f;
+    app.add_option("-L,--clipLimit", clipLimit, "Limit of the histogram bins relative to their mean count (<= 0: no limit)");
+
+    bool showImages = false;
+    app.add_flag("-S,--show", showImages, "Display input and output images in new windows");
+
+    int threads = -1;
+    app.add_option("-j,--threads", threads, "Number of threads (default: all the cores)");
+
+    CLI11_PARSE(app, argc, argv);
+    setNumThreads(threads);
+
+    Mat image = imreadHelper(inputImage, false);
+    Mat res_image = equalizeLocal(image, tiles, clipLimit);
+    imwriteHelper(res_image, outputImage);
+
+    // maybe show result
+    if (showImages) {
+        showimage(image, "Input Image");
+        showimage(res_image, "Output Image");
+        waitKey(0);
+        destroyAllWindows();
+    }
+
+    return 0;
+}
+
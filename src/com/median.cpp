@@ -22,7 +22,11 @@ int main( int argc, char** argv )
     int filterSize = 5;
     app.add_option("-M,--filterSize", filterSize, "Filter size ((X*2+1)*(X*2+1) square)")->required();
 
+    int threads = -1;
+    app.add_option("-j,--threads", threads, "Number of threads (default: all the cores)");
+
     CLI11_PARSE(app, argc, argv);
+    setNumThreads(threads);
 
     Mat image = imreadHelper(inputImage);
     Mat res_image = median(image, filterSize);
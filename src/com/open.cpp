@@ -22,7 +22,11 @@ int main( int argc, char** argv )
     string structuringElement = "";
     app.add_option("-E,--structuringElement", structuringElement, "Structuring element filename")->required();
 
+    int threads = -1;
+    app.add_option("-j,--threads", threads, "Number of threads (default: all the cores)");
+
     CLI11_PARSE(app, argc, argv);
+    setNumThreads(threads);
 
 
     Mat image = imreadHelper(inputImage);
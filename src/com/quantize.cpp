@@ -22,7 +22,11 @@ int main( int argc, char** argv )
     int quantizeLevel = 3;
     app.add_option("-Q,--quantizeLevel", quantizeLevel, "Number of quantization levels")->required();
 
+    int threads = -1;
+    app.add_option("-j,--threads", threads, "Number of threads (default: all the cores)");
+
     CLI11_PARSE(app, argc, argv);
+    setNumThreads(threads);
 
     Mat image = imreadHelper(inputImage);
     Mat res_image = quantize(image, quantizeLevel);
@@ -25,7 +25,11 @@ int main( int argc, char** argv )
     string interpolation = "bilinear";
     app.add_option("-P,--interpolation", interpolation, "Interpolation method ('nearest' or 'bilinear')");
 
+    int threads = -1;
+    app.add_option("-j,--threads", threads, "Number of threads (default: all the cores)");
+
     CLI11_PARSE(app, argc, argv);
+    setNumThreads(threads);
 
     float (* interpolationMethod)(Mat, float, float);
     if(interpolation.compare("bilinear")==0)
@@ -2,11 +2,17 @@
 #include <map>
 #include <iostream>
 #include "../common.h"
+#include "../tpConnectedComponents.h"
+#include "../tpHistogram.h"
 #include <vector>
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <fstream>
 #include <exception>
+#include <cmath>
+#include <cstring>
+#include <tuple>
+#include <algorithm>
 #include "CLI11.hpp"
 
 using namespace cv;
@@ -76,6 +82,49 @@ bool compIm(Mat im1, Mat im2, string msg, bool show)
     return !flag;
 }
 
+// smallest peak signal to noise ratio (in dB) of an approximation against the exact result
+#define APPROXIMATION_PSNR 40
+
+bool compImApproximation(Mat im1, Mat im2, string msg, bool show)
+{
+    if(im1.cols != im2.cols || im1.rows != im2.rows)
+    {
+        cerr << "\tDimensions incorrect, command:" << msg << endl;
+        return false;
+    }
+
+    if(im1.channels() != im2.channels())
+    {
+        cerr << "\tChannel number incorrect, command:" << msg << endl;
+        return false;
+    }
+
+    im1.convertTo(im1, CV_64F);
+    im2.convertTo(im2, CV_64F);
+    im1 = im1 / 255.0;
+    im2 = im2 / 255.0;
+    Mat tmp0 = im1 - im2;
+    Mat tmp;
+    pow(tmp0,2.0,tmp);
+    double mse = sum(tmp)[0] / ((double)im1.total() * im1.channels());
+    double psnr = (mse > 0) ? 10 * log10(1 / mse) : INFINITY;
+
+    if(psnr < APPROXIMATION_PSNR)
+    {
+        cerr <<  "\tPSNR " << psnr << " dB below " << APPROXIMATION_PSNR << " dB: problem detected, command: " << msg << endl;
+        if(show)
+        {
+            Mat op;
+            normalize(tmp,op,0,255,NORM_MINMAX);
+            showimage(op, msg.c_str());
+            waitKey(0);
+            destroyAllWindows();
+        }
+        return false;
+    }
+    return true;
+}
+
 Mat testImInjection(Mat im1, Mat im2){
     std::array<short, 256> map;
     for(std::size_t i = 0; i < 256; ++i)
@@ -143,6 +192,210 @@ bool compImBijection(Mat im1, Mat im2, string msg, bool show)
     return true;
 }
 
+// true if the label images a and b are equal up to a renumbering of the labels, 0 for both
+bool sameLabels(Mat a, Mat b)
+{
+    map<int, int> ab, ba;
+    for(int y = 0; y < a.rows; y++)
+        for(int x = 0; x < a.cols; x++)
+        {
+            int la = a.at<int>(y, x), lb = b.at<int>(y, x);
+            if((la == 0) != (lb == 0))
+                return false;
+            if(ab.insert({la, lb}).first->second != lb || ba.insert({lb, la}).first->second != la)
+                return false;
+        }
+    return true;
+}
+
+/**
+    Compares the labels of dynamic with ccLabel(image, stats): same components, same
+    number of components and same areas. Prints the failed step.
+*/
+bool checkDynamic(const DynamicLabeling & dynamic, Mat image, Connectivity connectivity, string step)
+{
+    vector<ComponentStats> stats;
+    Mat expected = ccLabel(image, stats, connectivity);
+    bool ok = sameLabels(dynamic.labels(), expected) && dynamic.components() == (int)stats.size() - 1;
+    for(int y = 0; ok && y < image.rows; y++)
+        for(int x = 0; ok && x < image.cols; x++)
+        {
+            int label = expected.at<int>(y, x);
+            if(label != 0)
+                ok = dynamic.area(dynamic.labels().at<int>(y, x)) == stats[label].area;
+        }
+    if(!ok)
+        cerr << "\tDynamicLabeling differs from ccLabel after the " << step << endl;
+    return ok;
+}
+
+/**
+    Paints and erases strokes on the image with DynamicLabeling, checking its labels
+    against ccLabel after each stroke:
+     - a path joining the first two components is painted, merging them
+     - the path is erased, splitting them again
+     - a row of the bounding box of the largest component is erased, then painted.
+*/
+bool testDynamicLabeling(string inputImage, Connectivity connectivity)
+{
+    Mat image = imreadHelper(inputImage);
+    DynamicLabeling dynamic(image, connectivity);
+    Mat edited = image.clone();
+    auto stroke = [&](const vector<Point> & pixels, bool present, string step) {
+        for(Point p : pixels)
+            edited.at<float>(p.y, p.x) = present ? 1.f : 0.f;
+        dynamic.update(pixels, present);
+        return checkDynamic(dynamic, edited, connectivity, step);
+    };
+
+    vector<ComponentStats> stats;
+    Mat labels = ccLabel(image, stats, connectivity);
+    if(stats.size() < 3)
+    {
+        cerr << "\tThe image " << inputImage << " needs two components" << endl;
+        return false;
+    }
+
+    // first pixels of the components 1 and 2, joined by a horizontal then vertical path
+    // through the absent pixels
+    Point first[3];
+    for(int y = labels.rows - 1; y >= 0; y--)
+        for(int x = labels.cols - 1; x >= 0; x--)
+            if(labels.at<int>(y, x) == 1 || labels.at<int>(y, x) == 2)
+                first[labels.at<int>(y, x)] = Point(x, y);
+    vector<Point> path;
+    Point p = first[1];
+    while(p != first[2])
+    {
+        if(p.x != first[2].x)
+            p.x += (first[2].x > p.x) ? 1 : -1;
+        else
+            p.y += (first[2].y > p.y) ? 1 : -1;
+        if(image.at<float>(p.y, p.x) == 0)
+            path.push_back(p);
+    }
+
+    int components = dynamic.components();
+    if(!stroke(path, true, "merge stroke"))
+        return false;
+    if(dynamic.components() >= components)
+    {
+        cerr << "\tThe merge stroke did not merge components" << endl;
+        return false;
+    }
+    if(!stroke(path, false, "split stroke"))
+        return false;
+    if(dynamic.components() != components)
+    {
+        cerr << "\tThe split stroke did not split the components" << endl;
+        return false;
+    }
+
+    int largest = 1;
+    for(size_t l = 1; l < stats.size(); l++)
+        if(stats[l].area > stats[largest].area)
+            largest = l;
+    Rect box = stats[largest].boundingBox();
+    vector<Point> row;
+    for(int x = box.x; x < box.x + box.width; x++)
+        row.push_back(Point(x, box.y + box.height / 2));
+    return stroke(row, false, "erase stroke") && stroke(row, true, "paint stroke");
+}
+
+/**
+    Feeds the image row by row to a StreamingLabeler and compares the areas and bounding
+    boxes of the components it finishes with those of ccLabel(image, stats).
+*/
+bool testStreamingLabeler(string inputImage, Connectivity connectivity)
+{
+    typedef tuple<int, int, int, int, int> Component;    // y, x, height, width, area
+    auto component = [](const ComponentStats & stats) {
+        Rect box = stats.boundingBox();
+        return Component(box.y, box.x, box.height, box.width, stats.area);
+    };
+
+    Mat image = imreadHelper(inputImage);
+    vector<Component> streamed;
+    StreamingLabeler labeler(image.cols, [&](const ComponentStats & stats) {
+        streamed.push_back(component(stats));
+    }, connectivity);
+    for(int y = 0; y < image.rows; y++)
+        labeler.addRow(image.ptr<float>(y));
+    labeler.finish();
+
+    vector<ComponentStats> stats;
+    ccLabel(image, stats, connectivity);
+    vector<Component> expected;
+    for(size_t l = 1; l < stats.size(); l++)
+        expected.push_back(component(stats[l]));
+
+    sort(streamed.begin(), streamed.end());
+    sort(expected.begin(), expected.end());
+    if(streamed != expected)
+    {
+        cerr << "\tStreamingLabeler found " << streamed.size() << " components, ccLabel " << expected.size()
+             << ": their areas or bounding boxes differ" << endl;
+        return false;
+    }
+    return true;
+}
+
+// true if the images a and b have the same size, type and bits, NaN included
+bool sameBits(Mat a, Mat b)
+{
+    if(a.size() != b.size() || a.type() != b.type())
+        return false;
+    for(int y = 0; y < a.rows; y++)
+        if(memcmp(a.ptr(y), b.ptr(y), a.cols * a.elemSize()) != 0)
+            return false;
+    return true;
+}
+
+/**
+    Applies chains of point operators with one PointPipeline and with the functions
+    inverse, threshold, quantize and normalize one after the other, on the 8 bit image
+    converted to float like the table of PointPipeline: the results must have the same bits. The
+    pipeline on the 8 bit image must give the float result rounded once. The normalizations
+    in the middle of the chains get their range from the stages before them.
+*/
+bool testPointPipeline(string inputImage)
+{
+    Mat image8 = imreadHelper(inputImage, false);
+    Mat image(image8.size(), CV_32FC1);
+    for(int y = 0; y < image.rows; y++)
+        for(int x = 0; x < image.cols; x++)
+            image.at<float>(y, x) = (float)(image8.at<uchar>(y, x) / 255.0);
+
+    typedef function<PointPipeline(Mat)> Pipeline;
+    vector<tuple<string, Pipeline, Mat>> chains = {
+        make_tuple(string("inverse, normalize, quantize, threshold"),
+                   Pipeline([](Mat im){ return PointPipeline(im).inverse().normalize().quantize(8).threshold(0.2f, 0.8f); }),
+                   threshold(quantize(normalize(inverse(image)), 8), 0.2f, 0.8f)),
+        make_tuple(string("threshold, inverse, normalize to [0.1, 0.9], quantize"),
+                   Pipeline([](Mat im){ return PointPipeline(im).threshold(0.3f, 0.7f).inverse().normalize(0.1f, 0.9f).quantize(5); }),
+                   quantize(normalize(inverse(threshold(image, 0.3f, 0.7f)), 0.1f, 0.9f), 5))};
+
+    for(auto & chain : chains)
+    {
+        Mat fused = get<1>(chain)(image).apply();
+        if(!sameBits(fused, get<2>(chain)))
+        {
+            cerr << "\tPointPipeline differs from " << get<0>(chain) << " on " << inputImage << endl;
+            return false;
+        }
+        Mat rounded(image.size(), CV_8UC1);
+        for(int y = 0; y < image.rows; y++)
+            for(int x = 0; x < image.cols; x++)
+                rounded.at<uchar>(y, x) = saturate_cast<uchar>(fused.at<float>(y, x) * 255);
+        if(!sameBits(get<1>(chain)(image8).apply(), rounded))
+        {
+            cerr << "\tPointPipeline on 8 bits differs from " << get<0>(chain) << " on " << inputImage << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
 bool exists_test (const std::string& name) {
   struct stat buffer;
   return (stat (name.c_str(), &buffer) == 0);
@@ -172,6 +425,41 @@ struct unittest{
     }
 };
 
+// test calling the library directly, without a reference result: check returns true on success
+struct librarytest{
+    using fun_t = std::function<bool()>;
+    string description;
+    fun_t check;
+
+    librarytest(string _description, fun_t _check): description(_description), check(_check){
+
+    }
+};
+
+void processLibrary(string name, vector<librarytest> tests)
+{
+    cout << KCYN << BOLD << name << RST << RST  << endl;
+    for(auto t : tests)
+    {
+        bool r = false;
+        try
+        {
+            r = t.check();
+        }
+        catch (exception& e)
+        {
+            cout << "\tException " << e.what() << endl;
+        }
+        if(r)
+            cout << "\tTest: "<< t.description << endl << KGRN << "\tok" << RST << endl;
+        else
+        {
+            cout << "\tTest: "<< t.description << endl;
+            printFail();
+        }
+    }
+}
+
 void process(string name, vector<unittest> tests, bool record, bool show, bool memorycheck)
 {
     if(exists_test(name))
@@ -258,10 +546,19 @@ int main( int argc, char** argv )
     map<string,vector<unittest>> p;
     p["inverse"] = {unittest("./inverse -I cat.jpg -O out.png")};
     p["normalize"] = {unittest("./normalize -I blobs-bad.png -O out.png")};
-    p["ccAreaFilter"] = {unittest("./ccAreaFilter -I binary.png -F 200 -O out.png")};
-    p["ccLabel"] = {unittest("./ccLabel -I binary.png -O out.png", compImBijection)};
+    p["ccAreaFilter"] = {unittest("./ccAreaFilter -I binary.png -F 200 -O out.png"),
+                         unittest("./ccAreaFilter -I binary.png -F 50 -C 8 -O out.png")};
+    p["ccLabel"] = {unittest("./ccLabel -I binary.png -O out.png", compImBijection),
+                    unittest("./ccLabel -I binary.png -C 8 -O out.png", compImBijection),
+                    unittest("./ccLabel -I binary.png -R -C 8 -O out.png", compImBijection),
+                    unittest("./ccLabel -I blobs.png -L 0.05 -C 8 -O out.png", compImBijection)};
     p["ccLabel2pass"] = {unittest("./ccLabel2pass -I binary.png -O out.png", compImBijection)};
-    p["equalize"] = {unittest("./equalize -I camera_mauvaise_balance.png -O out.png")};
+    p["areaOpening"] = {unittest("./areaOpening -I camera.png -F 500 -O out.png")};
+    p["areaClosing"] = {unittest("./areaClosing -I camera.png -F 500 -C 8 -O out.png")};
+    p["equalize"] = {unittest("./equalize -I camera_mauvaise_balance.png -O out.png"),
+                    unittest("./equalize -I camera_mauvaise_balance.png -B 1024 -O out.png")};
+    p["equalizeLocal"] = {unittest("./equalizeLocal -I camera_mauvaise_balance.png -O out.png"),
+                    unittest("./equalizeLocal -I camera_mauvaise_balance.png -T 5 -L 0 -O out.png")};
     p["expand"] = {unittest("./expand -I cat.jpg -F 3 -P nearest -O out.png"), 
                     unittest("./expand -I cat.jpg -F 3 -P bilinear -O out.png")};
     p["quantize"] = {unittest("./quantize -I cat.jpg -Q 3 -O out.png")};
@@ -270,40 +567,70 @@ int main( int argc, char** argv )
     p["threshold"] = {unittest("./threshold -I cat.jpg -L 0.2 -H 0.8 -O out.png")};
     p["transpose"] = {unittest("./transpose -I cat.jpg -O out.png")};
 
-    p["convolution"] = {unittest("./convolution -I cat.jpg -O out.png -K maskGauss5x5.png")};
+    p["convolution"] = {unittest("./convolution -I cat.jpg -O out.png -K maskGauss5x5.png"),
+                        unittest("./convolution -I cat.jpg -O out.png -K maskGauss5x5.png -B separable"),
+                        unittest("./convolution -I cat.jpg -O out.png -K maskGauss5x5.png -B fft")};
     p["meanFilter"] = {unittest("./meanFilter -I cat.jpg -M 5 -O out.png")};
     p["edgeSobel"] = {unittest("./edgeSobel -I cat.jpg -O out.png")};
-    p["bilateralFilter"] = {unittest("./bilateralFilter -I cat.jpg -C 0.1 -K maskGauss5x5.png -O out.png")};
-
-    p["median"] = {unittest("./median -I camera_bruit_poivre_et_sel.png -M 2 -O out.png")};
+    p["bilateralFilter"] = {unittest("./bilateralFilter -I cat.jpg -C 0.1 -K maskGauss5x5.png -O out.png"),
+                            unittest("./bilateralFilter -I cat.jpg -C 0.1 -K maskGauss5x5.png -M grid -O out.png"),
+                            unittest("./bilateralFilter -I cat.jpg -C 0.1 -K maskGauss5x5.png -M grid -O out.png", compImApproximation),
+                            unittest("./bilateralFilter -I camera_bruit_gaussien.png -C 0.1 -K maskGauss3x3.png -M grid -O out.png")};
+
+    p["median"] = {unittest("./median -I camera_bruit_poivre_et_sel.png -M 2 -O out.png"),
+                    unittest("./median -I camera_bruit_poivre_et_sel.png -M 10 -O out.png")};
+    p["rankFilter"] = {unittest("./rankFilter -I camera_bruit_poivre_et_sel.png -M 3 -R 0.25 -O out.png")};
     p["erode"] = {unittest("./erode -I binary.png -E morphoLineV.png -O out.png"),
-                    unittest("./erode -I cat.jpg -E morphoCross.png -O out.png")};
+                    unittest("./erode -I cat.jpg -E morphoCross.png -O out.png"),
+                    unittest("./erode -I cat.jpg -E morphoLineV51.png -O out.png"),
+                    unittest("./erode -I cat.jpg -E morphoDisk25.png -O out.png")};
     p["dilate"] = {unittest("./dilate -I binary.png -E morphoLineV.png -O out.png"),
-                    unittest("./dilate -I cat.jpg -E morphoLineV.png -O out.png")};
+                    unittest("./dilate -I cat.jpg -E morphoLineV.png -O out.png"),
+                    unittest("./dilate -I cat.jpg -E morphoLineV51.png -O out.png"),
+                    unittest("./dilate -I cat.jpg -E morphoDisk25.png -O out.png")};
     p["open"] = {unittest("./open -I binary.png -E morphoLineV.png -O out.png"),
-                unittest("./open -I cat.jpg -E morphoLineV.png -O out.png")};
+                unittest("./open -I cat.jpg -E morphoLineV.png -O out.png"),
+                unittest("./open -I cat.jpg -E morphoLineV51.png -O out.png")};
     p["close"] = {unittest("./close -I binary.png -E morphoCircle.png -O out.png"),
                 unittest("./close -I cat.jpg -E morphoCircle.png -O out.png")};
     p["morphologicalGradient"]  = {unittest("./morphologicalGradient -I binary.png -E morphoCross.png -O out.png"),
-                                unittest("./morphologicalGradient -I cat.jpg -E morphoCross.png -O out.png")};
+                                unittest("./morphologicalGradient -I cat.jpg -E morphoCross.png -O out.png"),
+                                unittest("./morphologicalGradient -I cat.jpg -E morphoLineV51.png -O out.png"),
+                                unittest("./morphologicalGradient -I binary.png -E morphoLineV16Right.png -O out.png")};
 
     p["thresholdOtsu"] = {unittest("./thresholdOtsu -I cat.jpg -O out.png")};
-
-    /*p["detectRectangle"] = {"./detectRectangle -I cas1.png -O out.png",
-                            "./detectRectangle -I cas2.png -O out.png",
-                            "./detectRectangle -I cas3.png -O out.png",
-                            "./detectRectangle -I cas4.png -O out.png",
-                            "./detectRectangle -I cas5.png -O out.png",
-                            "./detectRectangle -I cas6.png -O out.png"};
-    
-    p["thresholdKMean"] = {"./thresholdKMean -I cat.jpg -O out.png"};
+    p["thresholdLocal"] = {unittest("./thresholdLocal -I blood.png -K 15 -W 0.2 -O out.png"),
+                    unittest("./thresholdLocal -I blood.png -M niblack -O out.png")};
+
+    p["detectRectangle"] = {unittest("./detectRectangle -I cas1.png -O out.png"),
+                            unittest("./detectRectangle -I cas2.png -O out.png"),
+                            unittest("./detectRectangle -I cas3.png -O out.png"),
+                            unittest("./detectRectangle -I cas4.png -O out.png"),
+                            unittest("./detectRectangle -I cas5.png -O out.png"),
+                            unittest("./detectRectangle -I cas6.png -O out.png")};
+
+    map<string,vector<librarytest>> l;
+    l["DynamicLabeling"] = {librarytest("strokes on binary.png, 4-connectivity",
+                                        [](){ return testDynamicLabeling("binary.png", CONNECTIVITY_4); }),
+                            librarytest("strokes on binary.png, 8-connectivity",
+                                        [](){ return testDynamicLabeling("binary.png", CONNECTIVITY_8); })};
+    l["StreamingLabeler"] = {librarytest("rows of binary.png, 4-connectivity",
+                                         [](){ return testStreamingLabeler("binary.png", CONNECTIVITY_4); }),
+                             librarytest("rows of binary.png, 8-connectivity",
+                                         [](){ return testStreamingLabeler("binary.png", CONNECTIVITY_8); })};
+    l["PointPipeline"] = {librarytest("chains with a normalization on cat.jpg",
+                                      [](){ return testPointPipeline("cat.jpg"); }),
+                          librarytest("chains with a normalization on blobs-bad.png",
+                                      [](){ return testPointPipeline("blobs-bad.png"); })};
+
+    /*p["thresholdKMean"] = {"./thresholdKMean -I cat.jpg -O out.png"};
     
     p["thresholdSigmaClipping"] = {"./thresholdSigmaClipping -I img1-11.tiff -O out.png"};*/
 
     CLI::App app{"Test program"};
 
     string program = "";
-    app.add_option("-P,--program", program, "Command to test");
+    app.add_option("-P,--program", program, "Command or library class to test");
 
     bool record = false;
     app.add_flag("--recordmode", record, "Record new test results");
@@ -329,6 +656,9 @@ int main( int argc, char** argv )
                 exit(1);
             }
             process(prog, p[prog],record, show, !fastmode);
+        }else if (l.count(prog))
+        {
+            processLibrary(prog, l[prog]);
         }else{
             cerr << "Unknown program " << prog << endl;
             exit(1);
@@ -339,6 +669,9 @@ int main( int argc, char** argv )
             string k = iter->first;
             process(k, iter->second, record, show, !fastmode);
         }
+        if(!record)
+            for(auto iter = l.begin(); iter != l.end(); ++iter)
+                processLibrary(iter->first, iter->second);
 
     }
 
@@ -25,7 +25,11 @@ int main( int argc, char** argv )
     float thresholdHigh = 0;
     app.add_option("-H,--thresholdHigh", thresholdHigh, "High threshold")->required();
 
+    int threads = -1;
+    app.add_option("-j,--threads", threads, "Number of threads (default: all the cores)");
+
     CLI11_PARSE(app, argc, argv);
+    setNumThreads(threads);
 
 
     Mat image = imreadHelper(inputImage);
@@ -0,0 +1,63 @@
+#include "../common.h"
+#include "../tpHistogram.h"
+#include "CLI11.hpp"
+
+using namespace cv;
+using namespace std;
+
+int main( int argc, char** argv )
+{
+    CLI::App app{"Local threshold"};
+
+    string inputImage = "blood.png";
+    app.add_option("-I,--inputImage", inputImage, "Input image filename");
+
+    string outputImage = "out.png";
+    app.add_option("-O,--outputImage", outputImage, "Output image filename");
+
+    bool showImages = false;
+    app.add_flag("-S,--show", showImages, "Display input and output images in new windows");
+
+    int windowSize = 7;
+    app.add_option("-K,--windowSize", windowSize, "Window half size (window size is 2k+1)");
+
+    string methodName = "sauvola";
+    app.add_option("-M,--method", methodName, "Local threshold method ('sauvola' or 'niblack')");
+
+    float weight = 0;
+    CLI::Option * weightOption = app.add_option("-W,--weight", weight, "Weight of the standard deviation (default: 0.5 for sauvola, -0.2 for niblack)");
+
+    int threads = -1;
+    app.add_option("-j,--threads", threads, "Number of threads (default: all the cores)");
+
+    CLI11_PARSE(app, argc, argv);
+    setNumThreads(threads);
+
+    LocalThresholdMethod method;
+    if(methodName.compare("sauvola")==0)
+        method = THRESHOLD_SAUVOLA;
+    else if(methodName.compare("niblack")==0)
+        method = THRESHOLD_NIBLACK;
+    else
+    {
+        std::cerr << "Local threshold method unknown:" << methodName << std::endl;
+        exit(1);
+    }
+    if(weightOption->count() == 0)
+        weight = (method == THRESHOLD_SAUVOLA) ? 0.5f : -0.2f;
+
+
+    Mat image = imreadHelper(inputImage);
+    Mat res_image = thresholdLocal(image, windowSize, weight, method);
+    imwriteHelper(res_image, outputImage);
+
+    // maybe show result
+    if (showImages) {
+        showimage(image, "Input Image");
+        showimage(res_image, "Output Image");
+        waitKey(0);
+        destroyAllWindows();
+    }
+
+    return 0;
+}
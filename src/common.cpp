@@ -1,7 +1,10 @@
 #include "common.h"
 #include <exception>
 #include <iostream>
-#include <map>
+#include <unordered_map>
+#include <mutex>
+#include <climits>
+#include <algorithm>
 #include "stdio.h"
 
 using namespace cv;
@@ -85,22 +88,175 @@ void showimage(cv::Mat image, const char * name)
 
 cv::Mat remap_labels(cv::Mat label_image)
 {
-    map<int, int> label_map;
-    label_map[0] = 0;
-
     Mat res = Mat::zeros(label_image.rows, label_image.cols, CV_32SC1);
+    if(label_image.empty())
+        return res;
+
+    // range of the labels
+    int minLabel = INT_MAX, maxLabel = INT_MIN;
+    std::mutex merge;
+    parallelRows(label_image.rows, [&](int rowStart, int rowEnd){
+        int bandMin = INT_MAX, bandMax = INT_MIN;
+        for(int y = rowStart; y < rowEnd; ++y){
+            const int * in = label_image.ptr<int>(y);
+            for(int x = 0; x < label_image.cols; ++x){
+                bandMin = std::min(bandMin, in[x]);
+                bandMax = std::max(bandMax, in[x]);
+            }
+        }
+        std::lock_guard<std::mutex> lock(merge);
+        minLabel = std::min(minLabel, bandMin);
+        maxLabel = std::max(maxLabel, bandMax);
+    });
+
+    // new labels in order of first occurrence (0 stays 0): only the first pixel of each
+    // run of equal labels along a row is looked up
     int current_label = 1;
+    auto forEachRunStart = [&](const std::function<void(int label)> & assign){
+        for(int y = 0; y < label_image.rows; ++y){
+            const int * in = label_image.ptr<int>(y);
+            for(int x = 0; x < label_image.cols; ++x)
+                if(x == 0 || in[x] != in[x - 1])
+                    assign(in[x]);
+        }
+    };
 
-    for(int y = 0; y < label_image.rows; ++y){
-        for(int x = 0; x < label_image.cols; ++x){
-            int l = label_image.at<int>(y, x);
-            if(label_map.count(l) == 0){
-                label_map[l] = current_label;
-                current_label++;
+    long long range = (long long)maxLabel - minLabel + 1;
+    if(range <= 2 * (long long)label_image.total() + 256){
+        // dense table indexed by label - minLabel, -1 for the labels not met yet
+        vector<int> label_map(range, -1);
+        if(minLabel <= 0 && 0 <= maxLabel)
+            label_map[-(long long)minLabel] = 0;
+        forEachRunStart([&](int l){
+            int & mapped = label_map[l - (long long)minLabel];
+            if(mapped < 0)
+                mapped = current_label++;
+        });
+
+        parallelRows(label_image.rows, [&](int rowStart, int rowEnd){
+            for(int y = rowStart; y < rowEnd; ++y){
+                const int * in = label_image.ptr<int>(y);
+                int * out = res.ptr<int>(y);
+                for(int x = 0; x < label_image.cols; ++x)
+                    out[x] = label_map[in[x] - minLabel];
+            }
+        });
+    }else{
+        // labels too sparse for a table covering their range
+        unordered_map<int, int> label_map;
+        label_map[0] = 0;
+        forEachRunStart([&](int l){
+            if(label_map.count(l) == 0)
+                label_map[l] = current_label++;
+        });
+
+        parallelRows(label_image.rows, [&](int rowStart, int rowEnd){
+            for(int y = rowStart; y < rowEnd; ++y){
+                const int * in = label_image.ptr<int>(y);
+                int * out = res.ptr<int>(y);
+                for(int x = 0; x < label_image.cols; ++x)
+                    out[x] = (x > 0 && in[x] == in[x - 1]) ? out[x - 1] : label_map.at(in[x]);
             }
-            res.at<int>(y, x) = label_map[l];
+        });
+    }
+
+    return res;
+}
+
+
+template<typename T>
+static void integralImageRows(const cv::Mat & image, cv::Mat & res, bool squared)
+{
+    for(int y = 0; y < image.rows; ++y){
+        const T * in = image.ptr<T>(y);
+        const double * above = res.ptr<double>(y);
+        double * out = res.ptr<double>(y + 1);
+        double rowSum = 0;
+        for(int x = 0; x < image.cols; ++x){
+            double v = in[x];
+            rowSum += squared ? v * v : v;
+            out[x + 1] = above[x + 1] + rowSum;
         }
     }
+}
+
+cv::Mat integralImage(cv::Mat image, bool squared)
+{
+    Mat res = Mat::zeros(image.rows + 1, image.cols + 1, CV_64FC1);
+
+    if(image.type() == CV_8UC1)
+        integralImageRows<uchar>(image, res, squared);
+    else if(image.type() == CV_32FC1)
+        integralImageRows<float>(image, res, squared);
+    else
+        throw std::runtime_error("Unsupported image type for integral image");
 
     return res;
-}
\ No newline at end of file
+}
+
+cv::Mat levelValues()
+{
+    Mat levels(1, 256, CV_8UC1);
+    for(int q = 0; q < 256; ++q)
+        levels.at<uchar>(0, q) = (uchar)q;
+    // same conversion as imreadHelper
+    Mat res;
+    levels.convertTo(res, CV_32FC1);
+    res /= 255.0;
+    return res;
+}
+
+bool quantizedLevels(cv::Mat image, cv::Mat & levels)
+{
+    if(image.type() != CV_32FC1)
+        return false;
+
+    Mat values = levelValues();
+    const float * value = values.ptr<float>(0);
+    Mat res(image.size(), CV_8UC1);
+
+    for(int y = 0; y < image.rows; ++y){
+        const float * in = image.ptr<float>(y);
+        uchar * out = res.ptr<uchar>(y);
+        for(int x = 0; x < image.cols; ++x){
+            float scaled = in[x] * 255.f;
+            if(!(scaled > -0.5f && scaled < 255.5f))
+                return false;
+            int q = cvRound(scaled);
+            if(value[q] != in[x])
+                return false;
+            out[x] = (uchar)q;
+        }
+    }
+
+    levels = res;
+    return true;
+}
+
+int rowBands(int rows, int minBandRows)
+{
+    if(rows <= 0)
+        return 0;
+    // a few bands per thread to balance the load without splitting into single rows
+    return std::max(1, std::min(4 * cv::getNumThreads(), rows / std::max(minBandRows, 1)));
+}
+
+void parallelBands(int rows, int bands, const std::function<void(int band, int rowStart, int rowEnd)> & body)
+{
+    auto rowStart = [&](int band){ return (int)((long long)band * rows / bands); };
+    if(bands == 1){
+        body(0, 0, rows);
+        return;
+    }
+    cv::parallel_for_(cv::Range(0, bands), [&](const cv::Range & range){
+        for(int band = range.start; band < range.end; band++)
+            body(band, rowStart(band), rowStart(band + 1));
+    });
+}
+
+void parallelRows(int rows, const std::function<void(int rowStart, int rowEnd)> & body, int minBandRows)
+{
+    parallelBands(rows, rowBands(rows, minBandRows), [&](int band, int rowStart, int rowEnd){
+        body(rowStart, rowEnd);
+    });
+}
@@ -4,6 +4,7 @@
 #include <opencv2/opencv.hpp>
 #include <string>
 #include <initializer_list>
+#include <functional>
 
 
 /**
@@ -29,4 +30,54 @@ void showimage(cv::Mat image, const char * name=NULL);
 /**
  * Remaps a label image between 0 and the number of labels - 1
  */
-cv::Mat remap_labels(cv::Mat label_image);
\ No newline at end of file
+cv::Mat remap_labels(cv::Mat label_image);
+
+/**
+ * Summed-area table of a single channel float or unsigned char image.
+ *
+ * The result has size (rows+1)*(cols+1) and type CV_64FC1: res(y, x) is the sum of
+ * all the pixels (p, q) of image with p < y and q < x. If squared is true, the
+ * squared pixel values are summed instead.
+ *
+ * Accumulation is done in double precision: for unsigned char images the sums are
+ * exact up to 2^53 / 255^2 (about 1.4e11) pixels.
+ */
+cv::Mat integralImage(cv::Mat image, bool squared=false);
+
+/**
+ * The 256 float values produced by imreadHelper for the 8 bit values 0 to 255,
+ * as a 1*256 CV_32FC1 image.
+ */
+cv::Mat levelValues();
+
+/**
+ * Checks if every pixel of a single channel float image is one of the levelValues(),
+ * i.e. if the image holds 8 bit data loaded with imreadHelper. In this case, the level
+ * indices are stored in levels (type CV_8UC1) and the function returns true.
+ */
+bool quantizedLevels(cv::Mat image, cv::Mat & levels);
+
+/**
+ * Calls body(rowStart, rowEnd) on bands of consecutive rows covering [0, rows[, the
+ * bands being processed in parallel with cv::parallel_for_ (the number of threads is
+ * set with cv::setNumThreads, see the option -j of the command line programs).
+ *
+ * Bands have at least minBandRows rows: operators with a setup cost per band (e.g. a
+ * sliding window filled at the first row of the band) use it to amortize this cost.
+ * The bands must write disjoint rows of the result for it to be deterministic.
+ */
+void parallelRows(int rows, const std::function<void(int rowStart, int rowEnd)> & body, int minBandRows=1);
+
+/**
+ * Number of bands parallelRows(rows, body, minBandRows) cuts the rows in: a few per
+ * thread, 0 when there are no rows.
+ */
+int rowBands(int rows, int minBandRows=1);
+
+/**
+ * Calls body(band, rowStart, rowEnd) for each band in [0, bands[ on the rows
+ * [band * rows / bands, (band + 1) * rows / bands[, the bands being processed in parallel.
+ * For the operators keeping some state per band in an array of bands entries; with
+ * bands = rowBands(rows, minBandRows), the bands are those of parallelRows.
+ */
+void parallelBands(int rows, int bands, const std::function<void(int band, int rowStart, int rowEnd)> & body);
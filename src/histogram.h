@@ -0,0 +1,103 @@
+// Histograms of images computed in parallel
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include <mutex>
+#include <algorithm>
+#include "common.h"
+
+
+/**
+    Count the n pixels of a row of type T in lanes sub-histograms of bins bins each, stored one
+    after the other in counts: pixel x goes to lane x % lanes, so that the equal neighbour
+    values of flat regions increment different counters, instead of each increment waiting
+    for the previous one to be stored. binOf(value) gives the bin of each value, in [0, bins[.
+*/
+template<typename T, int lanes, typename BinFunction>
+inline void countLanes(const T * in, int n, int bins, BinFunction binOf, int * counts)
+{
+    int x = 0;
+    for (; x + lanes <= n; x += lanes)
+        for (int l = 0; l < lanes; l++)
+            counts[l * bins + binOf(in[x + l])]++;
+    for (; x < n; x++)
+        counts[binOf(in[x])]++;
+}
+
+/**
+    Sum the lanes sub-histograms of counts (see countLanes) into the first one.
+*/
+inline void mergeLanes(int * counts, int lanes, int bins)
+{
+    for (int l = 1; l < lanes; l++)
+        for (int b = 0; b < bins; b++)
+            counts[b] += counts[l * bins + b];
+}
+
+/**
+    Histogram of an image of pixels of type T with bins bins: binOf(value) gives the bin of
+    each value, in [0, bins[.
+
+    Each band of rows (see parallelRows) counts its pixels in lanes sub-histograms (see
+    countLanes), summed when the band is done, and the bands are merged: the counts are
+    exact whatever the number of threads.
+*/
+template<typename T, int lanes, typename BinFunction>
+std::vector<int> histogramLanes(const cv::Mat & image, int bins, BinFunction binOf)
+{
+    std::vector<int> hist(bins, 0);
+    std::mutex merge;
+
+    parallelRows(image.rows, [&](int rowStart, int rowEnd) {
+        std::vector<int> counts(lanes * bins, 0);
+        for (int y = rowStart; y < rowEnd; y++)
+            countLanes<T, lanes>(image.ptr<T>(y), image.cols, bins, binOf, &counts[0]);
+        mergeLanes(&counts[0], lanes, bins);
+
+        std::lock_guard<std::mutex> lock(merge);
+        for (int b = 0; b < bins; b++)
+            hist[b] += counts[b];
+    });
+    return hist;
+}
+
+/**
+    Histogram of an unsigned char image (CV_8UC1), one bin per value.
+*/
+inline std::vector<int> histogram256(const cv::Mat & image)
+{
+    return histogramLanes<uchar, 4>(image, 256, [](uchar v) { return (int)v; });
+}
+
+/**
+    Histogram of an unsigned short image (CV_16UC1), one bin per value. The histogram
+    is too large for several lanes to stay in cache, so each band counts in one.
+*/
+inline std::vector<int> histogram65536(const cv::Mat & image)
+{
+    return histogramLanes<ushort, 1>(image, 65536, [](ushort v) { return (int)v; });
+}
+
+/**
+    Bin of the value v in bins bins of equal width from minValue, scale being the number of
+    bins per unit (see histogramFloat). NaN fails every comparison and goes to the first bin.
+*/
+inline int floatBin(float v, int bins, float minValue, float scale)
+{
+    float bin = (v - minValue) * scale;
+    return !(bin > 0) ? 0 : (bin >= bins - 1) ? bins - 1 : (int)bin;
+}
+
+/**
+    Histogram of a float image (CV_32FC1) with bins bins of equal width covering
+    [minValue, maxValue]: value v goes to bin floor((v - minValue) * bins / (maxValue - minValue)),
+    the values out of the range to the first or last bin, maxValue to the last one, and NaN
+    to the first one (see floatBin).
+*/
+inline std::vector<int> histogramFloat(const cv::Mat & image, int bins, float minValue=0, float maxValue=1)
+{
+    float scale = bins / (maxValue - minValue);
+    return histogramLanes<float, 4>(image, bins, [=](float v) { return floatBin(v, bins, minValue, scale); });
+}
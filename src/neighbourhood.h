@@ -0,0 +1,58 @@
+// Iteration over the pixels of an image for neighbourhood operators
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include "simd.h"
+
+
+/**
+    Largest offsets of a neighbourhood in each direction: the neighbourhood of the
+    pixel (y, x) is included in the rectangle [y-top, y+bottom] x [x-left, x+right].
+*/
+struct NeighbourhoodExtent
+{
+    int top, bottom, left, right;
+
+    NeighbourhoodExtent(int top, int bottom, int left, int right) : top(top), bottom(bottom), left(left), right(right) {}
+};
+
+/**
+    Visit the pixels of rows [rowStart, rowEnd[ of an image of the given size, split in two sets:
+     - the border band, where the neighbourhood of a pixel may cross the image boundary:
+       border(y, x) is called for each of these pixels
+     - the interior, where the whole neighbourhood is inside the image: interiorRow(y, xStart, xEnd)
+       is called once for each row with the interior pixels [xStart, xEnd[ of the row
+
+    The interior functions can thus read the neighbourhood through row pointers without
+    any bounds check. interiorRow returns the first pixel of the row it did not process
+    (typically the tail of the row too short for a full vector): the pixels from there
+    to xEnd are passed to border instead.
+*/
+template<typename BorderFunction, typename InteriorRowFunction>
+void forEachPixelSplit(cv::Size size, NeighbourhoodExtent extent, int rowStart, int rowEnd,
+                       BorderFunction border, InteriorRowFunction interiorRow)
+{
+    int xStart = std::min(extent.left, size.width);
+    int xEnd = std::max(size.width - extent.right, xStart);
+
+    for (int y = rowStart; y < rowEnd; y++) {
+        if (y < extent.top || y >= size.height - extent.bottom) {
+            for (int x = 0; x < size.width; x++)
+                border(y, x);
+            continue;
+        }
+        for (int x = 0; x < xStart; x++)
+            border(y, x);
+        int x = (xStart < xEnd) ? interiorRow(y, xStart, xEnd) : xEnd;
+        for (; x < size.width; x++)
+            border(y, x);
+    }
+}
+
+template<typename BorderFunction, typename InteriorRowFunction>
+void forEachPixelSplit(cv::Size size, NeighbourhoodExtent extent, BorderFunction border, InteriorRowFunction interiorRow)
+{
+    forEachPixelSplit(size, extent, 0, size.height, border, interiorRow);
+}
@@ -0,0 +1,102 @@
+// Minimal portable vectors of floats
+
+#pragma once
+
+#include <cmath>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+
+/**
+    vfloat holds VFLOAT_WIDTH consecutive float values: an AVX or SSE register when the
+    target supports it, a plain float otherwise. vmask holds the results of a comparison
+    for each value, to choose between two vectors with vselect.
+
+    Every operation rounds exactly like the corresponding scalar float operation, so a
+    computation done lane by lane gives bit-identical results to the scalar code
+    performing the same operations in the same order.
+*/
+#if defined(__AVX__)
+
+typedef __m256 vfloat;
+static const int VFLOAT_WIDTH = 8;
+
+inline vfloat vload(const float * p) { return _mm256_loadu_ps(p); }
+inline void vstore(float * p, vfloat a) { _mm256_storeu_ps(p, a); }
+inline vfloat vset(float v) { return _mm256_set1_ps(v); }
+inline vfloat vadd(vfloat a, vfloat b) { return _mm256_add_ps(a, b); }
+inline vfloat vsub(vfloat a, vfloat b) { return _mm256_sub_ps(a, b); }
+inline vfloat vmul(vfloat a, vfloat b) { return _mm256_mul_ps(a, b); }
+inline vfloat vdiv(vfloat a, vfloat b) { return _mm256_div_ps(a, b); }
+// same operand order as std::min(a, b) and std::max(a, b)
+inline vfloat vmin(vfloat a, vfloat b) { return _mm256_min_ps(b, a); }
+inline vfloat vmax(vfloat a, vfloat b) { return _mm256_max_ps(b, a); }
+inline vfloat vabs(vfloat a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+inline vfloat vfloor(vfloat a) { return _mm256_floor_ps(a); }
+
+typedef __m256 vmask;
+inline vmask vle(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+inline vmask vlt(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+// a where m is set, b elsewhere
+inline vfloat vselect(vmask m, vfloat a, vfloat b) { return _mm256_blendv_ps(b, a, m); }
+
+#elif defined(__SSE2__) || defined(_M_X64)
+
+typedef __m128 vfloat;
+static const int VFLOAT_WIDTH = 4;
+
+inline vfloat vload(const float * p) { return _mm_loadu_ps(p); }
+inline void vstore(float * p, vfloat a) { _mm_storeu_ps(p, a); }
+inline vfloat vset(float v) { return _mm_set1_ps(v); }
+inline vfloat vadd(vfloat a, vfloat b) { return _mm_add_ps(a, b); }
+inline vfloat vsub(vfloat a, vfloat b) { return _mm_sub_ps(a, b); }
+inline vfloat vmul(vfloat a, vfloat b) { return _mm_mul_ps(a, b); }
+inline vfloat vdiv(vfloat a, vfloat b) { return _mm_div_ps(a, b); }
+// same operand order as std::min(a, b) and std::max(a, b)
+inline vfloat vmin(vfloat a, vfloat b) { return _mm_min_ps(b, a); }
+inline vfloat vmax(vfloat a, vfloat b) { return _mm_max_ps(b, a); }
+inline vfloat vabs(vfloat a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+// truncated through integers, with the sign of a kept for -0, minus one where that is above
+// a; the values from 2^23 on, infinities and NaN are already their own floor
+inline vfloat vfloor(vfloat a)
+{
+    __m128 t = _mm_or_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(a)), _mm_and_ps(a, _mm_set1_ps(-0.0f)));
+    t = _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a), _mm_set1_ps(1.0f)));
+    __m128 integral = _mm_cmpnlt_ps(vabs(a), _mm_set1_ps(8388608.0f));
+    return _mm_or_ps(_mm_and_ps(integral, a), _mm_andnot_ps(integral, t));
+}
+
+typedef __m128 vmask;
+inline vmask vle(vfloat a, vfloat b) { return _mm_cmple_ps(a, b); }
+inline vmask vlt(vfloat a, vfloat b) { return _mm_cmplt_ps(a, b); }
+// a where m is set, b elsewhere
+inline vfloat vselect(vmask m, vfloat a, vfloat b) { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+
+#else
+
+typedef float vfloat;
+static const int VFLOAT_WIDTH = 1;
+
+inline vfloat vload(const float * p) { return *p; }
+inline void vstore(float * p, vfloat a) { *p = a; }
+inline vfloat vset(float v) { return v; }
+inline vfloat vadd(vfloat a, vfloat b) { return a + b; }
+inline vfloat vsub(vfloat a, vfloat b) { return a - b; }
+inline vfloat vmul(vfloat a, vfloat b) { return a * b; }
+inline vfloat vdiv(vfloat a, vfloat b) { return a / b; }
+inline vfloat vmin(vfloat a, vfloat b) { return (b < a) ? b : a; }
+inline vfloat vmax(vfloat a, vfloat b) { return (a < b) ? b : a; }
+inline vfloat vabs(vfloat a) { return std::fabs(a); }
+inline vfloat vfloor(vfloat a) { return std::floor(a); }
+
+typedef bool vmask;
+inline vmask vle(vfloat a, vfloat b) { return a <= b; }
+inline vmask vlt(vfloat a, vfloat b) { return a < b; }
+// a where m is set, b elsewhere
+inline vfloat vselect(vmask m, vfloat a, vfloat b) { return m ? a : b; }
+
+#endif
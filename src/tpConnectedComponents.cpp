@@ -4,174 +4,1088 @@
 #include <tuple>
 #include <vector>
 #include <map>
-#include <stack>
+#include <functional>
+#include <climits>
+#include <cstring>
+#include "common.h"
 using namespace cv;
 using namespace std;
 
 
+ComponentStats::ComponentStats()
+    : area(0), minX(INT_MAX), minY(INT_MAX), maxX(INT_MIN), maxY(INT_MIN), sumX(0), sumY(0), sumIntensity(0)
+{
+}
+
+cv::Rect ComponentStats::boundingBox() const
+{
+    if (area == 0)
+        return Rect();
+    return Rect(minX, minY, maxX - minX + 1, maxY - minY + 1);
+}
+
+cv::Point2d ComponentStats::centroid() const
+{
+    return Point2d(sumX / area, sumY / area);
+}
+
+double ComponentStats::fillRatio() const
+{
+    if (area == 0)
+        return 0;
+    return area / ((double)(maxX - minX + 1) * (maxY - minY + 1));
+}
+
+void ComponentStats::add(int x, int y, float value)
+{
+    area++;
+    minX = std::min(minX, x);
+    minY = std::min(minY, y);
+    maxX = std::max(maxX, x);
+    maxY = std::max(maxY, y);
+    sumX += x;
+    sumY += y;
+    sumIntensity += value;
+}
+
+void ComponentStats::merge(const ComponentStats & other)
+{
+    area += other.area;
+    minX = std::min(minX, other.minX);
+    minY = std::min(minY, other.minY);
+    maxX = std::max(maxX, other.maxX);
+    maxY = std::max(maxY, other.maxY);
+    sumX += other.sumX;
+    sumY += other.sumY;
+    sumIntensity += other.sumIntensity;
+}
+
 /**
-    Performs a labeling of image connected component with 4 connectivity
-    with a depth-first exploration.
-    Any non zero pixel of the image is considered as present.
+    Equivalences between provisional labels as a flat union-find forest (label 0 is the
+    background). The root of a set is its smallest label, so parent[l] <= l for every label.
+    Labels are allocated from 1 by newLabel, the forest grows on demand.
 */
-void parcoursCC(Mat& image, Mat& res, int label, const vector<Point>& voisins, const Point& start) {
-    stack<Point> s;
-    s.push(start);
+struct LabelEquivalences
+{
+    vector<int> parent;
+
+    LabelEquivalences() : parent(1, 0) {}
+
+    int newLabel()
+    {
+        parent.push_back(parent.size());
+        return parent.size() - 1;
+    }
+
+    int find(int label)
+    {
+        // path halving
+        while (parent[label] != label) {
+            parent[label] = parent[parent[label]];
+            label = parent[label];
+        }
+        return label;
+    }
+
+    // merges the sets of a and b, returns the root of the union
+    int unite(int a, int b)
+    {
+        a = find(a);
+        b = find(b);
+        if (a < b)
+            std::swap(a, b);
+        parent[a] = b;
+        return b;
+    }
+
+    /**
+        Replaces parent[l] by the final label of the set of l: the sets are numbered from 1
+        in the order of their roots. Returns the number of sets (background excluded).
+    */
+    int flatten()
+    {
+        int count = 0;
+        for (size_t label = 1; label < parent.size(); label++)
+            parent[label] = (parent[label] == (int)label) ? ++count : parent[parent[label]];
+        return count;
+    }
+};
+
+/**
+    First pass of the two pass labeling on the rows [rowStart, rowEnd[ of a binary image,
+    ignoring the rows outside the strip: writes provisional labels in res, allocated in
+    raster order from the empty forest equivalences, and records their equivalences. If
+    stats is not NULL, stats[l - 1] accumulates the pixels that got the provisional label l.
+
+    Each pixel follows a decision tree on its already labeled neighbours (Wu et al.), which
+    skips the unions of neighbours that are already connected:
+     - 4 connectivity: when top, left and top-left are present, top and left are connected
+       through top-left
+     - 8 connectivity: top is connected to all the other neighbours (left was labeled with
+       top as its top-right neighbour), and top-left to left.
+*/
+static void scanStrip(Mat image, Mat res, LabelEquivalences & equivalences, int rowStart, int rowEnd,
+                      Connectivity connectivity, vector<ComponentStats> * stats)
+{
+    int cols = image.cols;
 
-    while (!s.empty()) {
-        Point r = s.top();
-        s.pop();
-        res.at<int>(r) = label;
+    for (int y = rowStart; y < rowEnd; y++) {
+        const float * in = image.ptr<float>(y);
+        const int * top = (y > rowStart) ? res.ptr<int>(y - 1) : NULL;
+        int * out = res.ptr<int>(y);
 
-        for (Point voisin : voisins) {
-            Point v = r + voisin;
-            if (v.x >= 0 && v.x < image.cols && v.y >= 0 && v.y < image.rows &&
-                image.at<float>(v) != 0 && res.at<int>(v) == 0) {
-                s.push(v);
+        for (int x = 0; x < cols; x++) {
+            if (in[x] == 0) {
+                out[x] = 0;
+                continue;
             }
+            int left = (x > 0) ? out[x - 1] : 0;
+            int up = (top != NULL) ? top[x] : 0;
+            int upLeft = (top != NULL && x > 0) ? top[x - 1] : 0;
+            int label;
+
+            if (connectivity == CONNECTIVITY_4) {
+                if (up != 0) {
+                    if (left == 0)
+                        label = up;
+                    else if (upLeft != 0)
+                        label = left;
+                    else
+                        label = equivalences.unite(left, up);
+                } else if (left != 0) {
+                    label = left;
+                } else {
+                    label = 0;
+                }
+            } else {
+                int upRight = (top != NULL && x + 1 < cols) ? top[x + 1] : 0;
+                if (up != 0)
+                    label = up;
+                else if (upRight != 0) {
+                    if (upLeft != 0)
+                        label = equivalences.unite(upRight, upLeft);
+                    else if (left != 0)
+                        label = equivalences.unite(upRight, left);
+                    else
+                        label = upRight;
+                } else if (upLeft != 0) {
+                    label = upLeft;
+                } else if (left != 0) {
+                    label = left;
+                } else {
+                    label = 0;
+                }
+            }
+
+            if (label == 0) {
+                label = equivalences.newLabel();
+                if (stats != NULL)
+                    stats->push_back(ComponentStats());
+            }
+            out[x] = label;
+            if (stats != NULL)
+                (*stats)[label - 1].add(x, y, in[x]);
         }
     }
 }
 
-Mat ccLabel(Mat image) {
-    Mat res = Mat::zeros(image.rows, image.cols, CV_32SC1);
-    int label = 1;
+/**
+    Same as scanStrip for the λ-connected components of an image of pixels of type T:
+    every pixel is present, and linked to its neighbours whose values differ from its own
+    by at most lambda. Links are not transitive, so there is no decision tree: each
+    already labeled neighbour linked to the pixel is united with it.
+*/
+template<typename T>
+static void scanStripLambda(Mat image, Mat res, LabelEquivalences & equivalences, int rowStart, int rowEnd,
+                            Connectivity connectivity, float lambda, vector<ComponentStats> * stats)
+{
+    int cols = image.cols;
 
-    vector<Point> voisins = {{-1, 0}, {0, -1}, {0, 1}, {1, 0}};
+    for (int y = rowStart; y < rowEnd; y++) {
+        const T * in = image.ptr<T>(y);
+        const T * inTop = (y > rowStart) ? image.ptr<T>(y - 1) : NULL;
+        const int * top = (y > rowStart) ? res.ptr<int>(y - 1) : NULL;
+        int * out = res.ptr<int>(y);
+
+        for (int x = 0; x < cols; x++) {
+            float value = in[x];
+            int label = 0;
+            auto link = [&](float neighbourValue, int neighbourLabel) {
+                if (std::fabs(neighbourValue - value) <= lambda)
+                    label = (label == 0) ? neighbourLabel : equivalences.unite(label, neighbourLabel);
+            };
+            if (x > 0)
+                link(in[x - 1], out[x - 1]);
+            if (top != NULL) {
+                link(inTop[x], top[x]);
+                if (connectivity == CONNECTIVITY_8) {
+                    if (x > 0)
+                        link(inTop[x - 1], top[x - 1]);
+                    if (x + 1 < cols)
+                        link(inTop[x + 1], top[x + 1]);
+                }
+            }
 
-    for (int y = 0; y < image.rows; y++) {
-        for (int x = 0; x < image.cols; x++) {
-            if (image.at<float>(y, x) != 0 && res.at<int>(y, x) == 0) {
-                parcoursCC(image, res, label, voisins, Point(x, y));
-                label++;
+            if (label == 0) {
+                label = equivalences.newLabel();
+                if (stats != NULL)
+                    stats->push_back(ComponentStats());
             }
+            out[x] = label;
+            if (stats != NULL)
+                (*stats)[label - 1].add(x, y, value);
+        }
+    }
+}
+
+/**
+    Two pass labeling of an image of the given size cut in horizontal strips of at least
+    minStripRows rows, processed in parallel:
+     - each strip is scanned with its own forest of provisional labels by
+       scan(res, equivalences, rowStart, rowEnd, stripStats) (see scanStrip), which is then
+       flattened: the components of the strip are numbered from 1, and the strip starting
+       at row y gives them the global labels following those of the previous strips
+     - the equivalences between the global labels of the last row of a strip and the first
+       row y of the next one are added where linked(y, xTop, xBottom) tells that the pixels
+       (y - 1, xTop) and (y, xBottom) are linked
+     - the global roots are numbered, and every provisional label is replaced by the
+       number of its global root.
+
+    The memory used is proportional to the number of labels allocated, not to the number
+    of pixels. The root of a component is its smallest label, that of its first pixel in
+    raster order: the labels are consecutive and numbered by first occurrence, as
+    remap_labels does, whatever the number of strips.
+
+    If stats is not NULL, it receives the statistics of each label l in stats[l] (stats[0]
+    is left empty): they are accumulated by provisional label during the scan, then merged
+    by final label, so the image is not read again. The merge follows the strips, so the
+    sums of intensities may differ in the last bits with the number of threads.
+*/
+template<typename ScanFunction, typename LinkFunction>
+static Mat stripLabeling(cv::Size size, int minStripRows, Connectivity connectivity, vector<ComponentStats> * stats,
+                         ScanFunction scan, LinkFunction linked)
+{
+    int rows = size.height;
+    int cols = size.width;
+    Mat res(size, CV_32SC1);
+
+    // strips[s]: first row of the strip s, stripLabels[s]: its flattened forest (provisional
+    // label to component number of the strip), stripStats[s]: statistics by component number - 1
+    int stripCount = rowBands(rows, minStripRows);
+    vector<int> strips(stripCount);
+    vector<LabelEquivalences> stripLabels(stripCount);
+    vector<int> componentCount(stripCount);
+    vector<vector<ComponentStats>> stripStats(stats != NULL ? stripCount : 0);
+    parallelBands(rows, stripCount, [&](int s, int rowStart, int rowEnd) {
+        strips[s] = rowStart;
+        LabelEquivalences & equivalences = stripLabels[s];
+        vector<ComponentStats> provisional;
+        scan(res, equivalences, rowStart, rowEnd, stats != NULL ? &provisional : NULL);
+        componentCount[s] = equivalences.flatten();
+        if (stats != NULL) {
+            stripStats[s].resize(componentCount[s]);
+            for (size_t label = 1; label < equivalences.parent.size(); label++)
+                stripStats[s][equivalences.parent[label] - 1].merge(provisional[label - 1]);
+        }
+    });
+
+    // the components of strip s have the global labels ]firstLabel[s], firstLabel[s + 1]]
+    vector<size_t> firstLabel(1, 0);
+    for (int s = 0; s < stripCount; s++)
+        firstLabel.push_back(firstLabel.back() + componentCount[s]);
+    CV_Assert(firstLabel.back() < (size_t)INT_MAX);
+
+    LabelEquivalences equivalences;
+    for (size_t label = 1; label <= firstLabel.back(); label++)
+        equivalences.newLabel();
+    auto globalLabel = [&](size_t s, int label) {
+        return (int)firstLabel[s] + stripLabels[s].parent[label];
+    };
+
+    int reach = (connectivity == CONNECTIVITY_8) ? 1 : 0;
+    for (size_t s = 1; s < strips.size(); s++) {
+        const int * top = res.ptr<int>(strips[s] - 1);
+        const int * bottom = res.ptr<int>(strips[s]);
+        for (int x = 0; x < cols; x++)
+            for (int dx = -reach; dx <= reach; dx++)
+                if (x + dx >= 0 && x + dx < cols && linked(strips[s], x + dx, x))
+                    equivalences.unite(globalLabel(s - 1, top[x + dx]), globalLabel(s, bottom[x]));
+    }
+    int count = equivalences.flatten();
+
+    if (stats != NULL) {
+        stats->assign(count + 1, ComponentStats());
+        for (size_t s = 0; s < strips.size(); s++) {
+            const vector<ComponentStats> & partial = stripStats[s];
+            for (size_t k = 0; k < partial.size(); k++)
+                (*stats)[equivalences.parent[firstLabel[s] + k + 1]].merge(partial[k]);
         }
     }
 
+    parallelRows(strips.size(), [&](int sStart, int sEnd) {
+        for (int s = sStart; s < sEnd; s++) {
+            // final label of each provisional label of the strip
+            const vector<int> & component = stripLabels[s].parent;
+            vector<int> finalLabel(component.size(), 0);
+            for (size_t label = 1; label < component.size(); label++)
+                finalLabel[label] = equivalences.parent[firstLabel[s] + component[label]];
+
+            int rowEnd = (s + 1 < (int)strips.size()) ? strips[s + 1] : rows;
+            for (int y = strips[s]; y < rowEnd; y++) {
+                int * out = res.ptr<int>(y);
+                for (int x = 0; x < cols; x++)
+                    out[x] = finalLabel[out[x]];
+            }
+        }
+    });
+
+    return res;
+}
+
+// stripLabeling of the present pixels of a binary image
+static Mat stripLabeling(Mat image, int minStripRows, Connectivity connectivity, vector<ComponentStats> * stats)
+{
+    return stripLabeling(image.size(), minStripRows, connectivity, stats,
+        [&](Mat res, LabelEquivalences & equivalences, int rowStart, int rowEnd, vector<ComponentStats> * stripStats) {
+            scanStrip(image, res, equivalences, rowStart, rowEnd, connectivity, stripStats);
+        },
+        [&](int y, int xTop, int xBottom) {
+            return image.at<float>(y - 1, xTop) != 0 && image.at<float>(y, xBottom) != 0;
+        });
+}
+
+// stripLabeling of the λ-connected components of an image of pixels of type T
+template<typename T>
+static Mat stripLabelingLambda(Mat image, float lambda, int minStripRows, Connectivity connectivity,
+                               vector<ComponentStats> * stats)
+{
+    return stripLabeling(image.size(), minStripRows, connectivity, stats,
+        [&](Mat res, LabelEquivalences & equivalences, int rowStart, int rowEnd, vector<ComponentStats> * stripStats) {
+            scanStripLambda<T>(image, res, equivalences, rowStart, rowEnd, connectivity, lambda, stripStats);
+        },
+        [&](int y, int xTop, int xBottom) {
+            return std::fabs((float)image.at<T>(y - 1, xTop) - (float)image.at<T>(y, xBottom)) <= lambda;
+        });
+}
+
+// smallest strip labeled by a thread in ccLabel
+static const int LABELING_MIN_STRIP_ROWS = 32;
+
+/**
+    Performs a labeling of image connected component with the given connectivity.
+    Any non zero pixel of the image is considered as present.
+
+    Horizontal strips of the image are labeled in parallel (see stripLabeling).
+*/
+Mat ccLabel(Mat image, Connectivity connectivity)
+{
+    return stripLabeling(image, LABELING_MIN_STRIP_ROWS, connectivity, NULL);
+}
+
+/**
+    Same as ccLabel, and computes in the same pass the statistics of the components:
+    stats[l] describes the component of label l, for l from 1 to stats.size() - 1
+    (stats[0] is empty).
+*/
+Mat ccLabel(Mat image, vector<ComponentStats> & stats, Connectivity connectivity)
+{
+    return stripLabeling(image, LABELING_MIN_STRIP_ROWS, connectivity, &stats);
+}
+
+static Mat ccLabelLambda(Mat image, float lambda, vector<ComponentStats> * stats, Connectivity connectivity)
+{
+    CV_Assert(image.type() == CV_32FC1 || image.type() == CV_8UC1);
+    if (image.type() == CV_8UC1)
+        return stripLabelingLambda<uchar>(image, lambda, LABELING_MIN_STRIP_ROWS, connectivity, stats);
+    return stripLabelingLambda<float>(image, lambda, LABELING_MIN_STRIP_ROWS, connectivity, stats);
+}
+
+/**
+    Performs a labeling of the λ-connected components of a grayscale image: two neighbour
+    pixels are in the same component when their values differ by at most lambda, and a
+    component is made of the pixels joined by such links. With lambda = 0, the components
+    are the flat zones of the image.
+
+    Every pixel is labeled, from 1. The image is of type CV_32FC1 or CV_8UC1, lambda
+    being in the unit of its values. Horizontal strips of the image are labeled in
+    parallel (see stripLabeling).
+*/
+Mat ccLabelLambda(Mat image, float lambda, Connectivity connectivity)
+{
+    return ccLabelLambda(image, lambda, NULL, connectivity);
+}
+
+/**
+    Same as ccLabelLambda, and computes in the same pass the statistics of the components
+    (see ccLabel).
+*/
+Mat ccLabelLambda(Mat image, float lambda, vector<ComponentStats> & stats, Connectivity connectivity)
+{
+    return ccLabelLambda(image, lambda, &stats, connectivity);
+}
+
+// pixels of image whose label is kept (keep[label] != 0), 0 elsewhere
+static Mat keepComponents(Mat image, Mat labels, const vector<uchar> & keep)
+{
+    Mat res(image.size(), image.type());
+    parallelRows(image.rows, [&](int rowStart, int rowEnd) {
+        for (int y = rowStart; y < rowEnd; y++) {
+            const int * label = labels.ptr<int>(y);
+            const float * in = image.ptr<float>(y);
+            float * out = res.ptr<float>(y);
+            for (int x = 0; x < image.cols; x++)
+                out[x] = keep[label[x]] ? in[x] : 0;
+        }
+    });
     return res;
 }
 
 /**
-    Deletes the connected components (4 connectivity) containg less than size pixels.
+    Deletes the connected components containg less than size pixels.
+
+    The areas are given by the statistics of the labeling, and the pixels are then
+    filtered through a table telling for each label if its component is kept.
 */
-cv::Mat ccAreaFilter(cv::Mat image, int size)
+cv::Mat ccAreaFilter(cv::Mat image, int size, Connectivity connectivity)
 {
-    Mat res = Mat::zeros(image.rows, image.cols, image.type());
     assert(size>0);
 
-    Mat labels = ccLabel(image);
+    vector<ComponentStats> stats;
+    Mat labels = ccLabel(image, stats, connectivity);
 
-    map<int, int> compSizes;
+    vector<uchar> keep(stats.size(), 0);
+    for (size_t label = 1; label < stats.size(); label++)
+        keep[label] = stats[label].area >= size;
 
-    int y = 0;
-    while (y < labels.rows) {
-        int x = 0;
-        while (x < labels.cols) {
-            int label = labels.at<int>(y, x);
-            if (label > 0) {
-                compSizes[label]++;
-            }
+    return keepComponents(image, labels, keep);
+}
+
+/**
+    Keeps the connected components that are axis aligned rectangles: those filling at
+    least 1 - tolerance of their bounding box. The other pixels are set to 0.
+
+    The areas and bounding boxes are given by the statistics of a single labeling pass,
+    then the pixels are filtered through a table telling for each label if it is kept.
+    The bounding boxes of the rectangles are added to rectangles, in raster order of
+    their first pixel.
+*/
+cv::Mat detectRectangle(cv::Mat image, std::vector<cv::Rect> & rectangles, float tolerance, Connectivity connectivity)
+{
+    vector<ComponentStats> stats;
+    Mat labels = ccLabel(image, stats, connectivity);
+
+    vector<uchar> keep(stats.size(), 0);
+    for (size_t label = 1; label < stats.size(); label++) {
+        keep[label] = stats[label].fillRatio() >= 1 - tolerance;
+        if (keep[label])
+            rectangles.push_back(stats[label].boundingBox());
+    }
+
+    return keepComponents(image, labels, keep);
+}
+
+cv::Mat detectRectangle(cv::Mat image, float tolerance, Connectivity connectivity)
+{
+    vector<cv::Rect> rectangles;
+    return detectRectangle(image, rectangles, tolerance, connectivity);
+}
+
+cv::Mat RunLengthLabels::toImage() const
+{
+    Mat res = Mat::zeros(rows, cols, CV_32SC1);
+    parallelRows(rows, [&](int rowStart, int rowEnd) {
+        for (int y = rowStart; y < rowEnd; y++) {
+            int * out = res.ptr<int>(y);
+            for (int r = this->rowStart[y]; r < this->rowStart[y + 1]; r++)
+                std::fill(out + runs[r].start, out + runs[r].end, runs[r].label);
+        }
+    });
+    return res;
+}
+
+/**
+    Calls body(start, end) for every run [start, end[ of non zero values of the row of
+    cols values, from left to right.
+*/
+template<typename RunFunction>
+static void forEachRun(const float * in, int cols, RunFunction body)
+{
+    for (int x = 0; x < cols; ) {
+        if (in[x] == 0) {
             x++;
+            continue;
         }
-        y++;
+        int start = x;
+        while (x < cols && in[x] != 0)
+            x++;
+        body(start, x);
     }
+}
 
-    y = 0;
-    while (y < labels.rows) {
-        int x = 0;
-        while (x < labels.cols) {
-            int label = labels.at<int>(y, x);
-            if (label > 0 && compSizes[label] >= size) {
-                res.at<float>(y, x) = image.at<float>(y, x);
-            }
-            x++;
+/**
+    Labeling of the connected components of a binary image by runs of present pixels:
+    the rows are cut in runs in parallel, then the runs of each row are joined to the
+    runs they touch in the previous row (same columns, or adjacent columns too for 8
+    connectivity) in a union-find forest over the runs. The pixels are only read once:
+    each band of rows collects its runs and the number of runs of each row, and the runs
+    of the bands are then copied after those of the previous bands. The work and memory
+    of the labeling depend on the number of runs: sparse images are labeled much faster
+    than pixel by pixel.
+
+    The root of a set is its first run in raster order, so the components are numbered
+    by first occurrence, giving the same labels as ccLabel (see RunLengthLabels::toImage).
+*/
+RunLengthLabels ccLabelRuns(cv::Mat image, Connectivity connectivity)
+{
+    RunLengthLabels res;
+    res.rows = image.rows;
+    res.cols = image.cols;
+    res.rowStart.assign(image.rows + 1, 0);
+
+    // bandRuns[b]: runs of the rows of band b, firstRow[b]: its first row
+    int bands = rowBands(image.rows);
+    vector<vector<LabelRun>> bandRuns(bands);
+    vector<int> firstRow(bands);
+    parallelBands(image.rows, bands, [&](int band, int rowStart, int rowEnd) {
+        firstRow[band] = rowStart;
+        vector<LabelRun> & runs = bandRuns[band];
+        for (int y = rowStart; y < rowEnd; y++) {
+            size_t count = runs.size();
+            forEachRun(image.ptr<float>(y), image.cols, [&](int start, int end) {
+                runs.push_back(LabelRun{start, end, 0});
+            });
+            res.rowStart[y + 1] = runs.size() - count;
         }
-        y++;
+    });
+    for (int y = 0; y < image.rows; y++)
+        res.rowStart[y + 1] += res.rowStart[y];
+    res.runs.resize(res.rowStart[image.rows]);
+    for (int band = 0; band < bands; band++)
+        std::copy(bandRuns[band].begin(), bandRuns[band].end(), res.runs.begin() + res.rowStart[firstRow[band]]);
+
+    LabelEquivalences equivalences;
+    equivalences.parent.reserve(res.runs.size() + 1);
+    for (size_t r = 0; r < res.runs.size(); r++)
+        equivalences.newLabel();
+
+    int reach = (connectivity == CONNECTIVITY_8) ? 1 : 0;
+    for (int y = 1; y < image.rows; y++) {
+        int first = res.rowStart[y - 1];
+        for (int r = res.rowStart[y]; r < res.rowStart[y + 1]; r++) {
+            const LabelRun & run = res.runs[r];
+            while (first < res.rowStart[y] && res.runs[first].end + reach <= run.start)
+                first++;
+            for (int p = first; p < res.rowStart[y] && res.runs[p].start < run.end + reach; p++)
+                equivalences.unite(p + 1, r + 1);
+        }
+    }
+
+    // the union-find labels are the run indices + 1: parent[r + 1] <= r + 1
+    res.components = 0;
+    for (size_t r = 0; r < res.runs.size(); r++) {
+        int parent = equivalences.parent[r + 1];
+        res.runs[r].label = (parent == (int)r + 1) ? ++res.components : res.runs[parent - 1].label;
     }
+
     return res;
 }
 
+StreamingLabeler::StreamingLabeler(int width, std::function<void(const ComponentStats &)> finished,
+                                   Connectivity connectivity)
+    : width(width), finished(finished), connectivity(connectivity), y(0)
+{
+}
+
+int StreamingLabeler::find(int component)
+{
+    // path halving
+    while (parent[component] != component) {
+        parent[component] = parent[parent[component]];
+        component = parent[component];
+    }
+    return component;
+}
+
+// merges the components a and b and their statistics, returns the root of the union
+int StreamingLabeler::unite(int a, int b)
+{
+    a = find(a);
+    b = find(b);
+    if (a == b)
+        return a;
+    if (a < b)
+        std::swap(a, b);
+    parent[a] = b;
+    components[b].merge(components[a]);
+    return b;
+}
+
 /**
-    Performs a labeling of image connected component with 4 connectivity using a
-    2 pass algorithm.
-    Any non zero pixel of the image is considered as present.
+    The runs of the row are joined to the runs of the previous row they touch (same
+    columns, or adjacent columns too for 8 connectivity), found by sweeping both sorted
+    lists together. The components of the previous row that no run joined are finished,
+    the others are renumbered in order of their first run in the row.
 */
+void StreamingLabeler::addRow(const float * row)
+{
+    runs.clear();
+    forEachRun(row, width, [&](int start, int end) {
+        runs.push_back(Run(start, end));
+    });
 
-cv::Mat ccLabel2pass(cv::Mat image)
+    int previousComponents = components.size();
+    parent.resize(previousComponents);
+    for (int c = 0; c < previousComponents; c++)
+        parent[c] = c;
+
+    int reach = (connectivity == CONNECTIVITY_8) ? 1 : 0;
+    size_t first = 0;
+    for (Run & run : runs) {
+        while (first < previousRuns.size() && previousRuns[first].end + reach <= run.start)
+            first++;
+        for (size_t p = first; p < previousRuns.size() && previousRuns[p].start < run.end + reach; p++)
+            run.component = (run.component < 0) ? find(previousRuns[p].component)
+                                                : unite(run.component, previousRuns[p].component);
+        if (run.component < 0) {
+            run.component = parent.size();
+            parent.push_back(run.component);
+            components.push_back(ComponentStats());
+        }
+        ComponentStats & stats = components[run.component];
+        for (int x = run.start; x < run.end; x++)
+            stats.add(x, y, row[x]);
+    }
+
+    vector<int> liveIndex(parent.size(), -1);
+    vector<ComponentStats> live;
+    for (Run & run : runs) {
+        int root = find(run.component);
+        if (liveIndex[root] < 0) {
+            liveIndex[root] = live.size();
+            live.push_back(components[root]);
+        }
+        run.component = liveIndex[root];
+    }
+    for (int c = 0; c < previousComponents; c++)
+        if (parent[c] == c && liveIndex[c] < 0)
+            finished(components[c]);
+
+    components.swap(live);
+    previousRuns.swap(runs);
+    y++;
+}
+
+void StreamingLabeler::finish()
 {
-    int numRows = image.rows;
-    int numCols = image.cols;
-    int labelCounter = 0;
-    std::vector<std::vector<int>> labels(numRows, std::vector<int>(numCols, 0));
-    std::map<int, int> labelEquivalences;  // Déclaration de labelsEquivalence ici
-
-    for (int y = 0; y < numRows; y++) {
-        for (int x = 0; x < numCols; x++) {
-            if (image.at<float>(y, x) != 0) {
-                std::vector<int> neighboringLabels;
-
-                if (x > 0 && labels[y][x - 1] != 0)
-                    neighboringLabels.push_back(labels[y][x - 1]);
-                if (y > 0 && labels[y - 1][x] != 0)
-                    neighboringLabels.push_back(labels[y - 1][x]);
-
-                if (neighboringLabels.empty()) {
-                    labelCounter++;
-                    labels[y][x] = labelCounter;
-                } else {
-                    labels[y][x] = *std::min_element(neighboringLabels.begin(), neighboringLabels.end());
-                    for (int label : neighboringLabels) {
-                        if (label != labels[y][x]) {
-                            // Mettre à jour les équivalences de labels
-                            int currentLabel = labels[y][x];
-                            int neighborLabel = label;
-
-                            while (labelEquivalences.find(currentLabel) != labelEquivalences.end()) {
-                                currentLabel = labelEquivalences[currentLabel];
-                            }
-
-                            while (labelEquivalences.find(neighborLabel) != labelEquivalences.end()) {
-                                neighborLabel = labelEquivalences[neighborLabel];
-                            }
-
-                            if (currentLabel != neighborLabel) {
-                                labelEquivalences[currentLabel] = neighborLabel;
-                            }
-                        }
+    for (const ComponentStats & stats : components)
+        finished(stats);
+    components.clear();
+    previousRuns.clear();
+}
+
+int StreamingLabeler::liveComponents() const
+{
+    return components.size();
+}
+
+DynamicLabeling::DynamicLabeling(cv::Mat image, Connectivity connectivity)
+    : connectivity(connectivity), visitBase(1)
+{
+    vector<ComponentStats> stats;
+    labelImage = ccLabel(image, stats, connectivity);
+    areas.resize(stats.size());
+    for (size_t l = 0; l < stats.size(); l++)
+        areas[l] = stats[l].area;
+    visits = Mat::zeros(image.rows, image.cols, CV_32SC1);
+}
+
+const cv::Mat & DynamicLabeling::labels() const
+{
+    return labelImage;
+}
+
+int DynamicLabeling::area(int label) const
+{
+    return (label > 0 && label < (int)areas.size()) ? areas[label] : 0;
+}
+
+int DynamicLabeling::components() const
+{
+    return areas.size() - 1 - freeLabels.size();
+}
+
+int DynamicLabeling::newLabel()
+{
+    if (!freeLabels.empty()) {
+        int label = freeLabels.back();
+        freeLabels.pop_back();
+        return label;
+    }
+    areas.push_back(0);
+    return areas.size() - 1;
+}
+
+void DynamicLabeling::freeLabel(int label)
+{
+    areas[label] = 0;
+    freeLabels.push_back(label);
+}
+
+template<typename NeighbourFunction>
+void DynamicLabeling::forEachNeighbour(cv::Point p, NeighbourFunction f) const
+{
+    static const int dx[8] = {-1, 1, 0, 0, -1, 1, -1, 1};
+    static const int dy[8] = {0, 0, -1, 1, -1, -1, 1, 1};
+    for (int n = 0; n < (int)connectivity; n++) {
+        cv::Point q(p.x + dx[n], p.y + dy[n]);
+        if (q.x >= 0 && q.y >= 0 && q.x < labelImage.cols && q.y < labelImage.rows)
+            f(q);
+    }
+}
+
+// gives the label to the whole component of the seed pixel
+void DynamicLabeling::relabelComponent(cv::Point seed, int label)
+{
+    int old = labelImage.at<int>(seed);
+    vector<cv::Point> stack(1, seed);
+    labelImage.at<int>(seed) = label;
+    while (!stack.empty()) {
+        cv::Point p = stack.back();
+        stack.pop_back();
+        forEachNeighbour(p, [&](cv::Point q) {
+            int & l = labelImage.at<int>(q);
+            if (l == old) {
+                l = label;
+                stack.push_back(q);
+            }
+        });
+    }
+}
+
+/**
+    One breadth first search per seed, advanced by one pixel in turn: two searches meeting
+    are in the same piece of the component and are grouped. A group whose searches are
+    exhausted is a whole separated piece and gets a new label. The last group left keeps
+    the label without being explored further.
+*/
+void DynamicLabeling::splitComponent(int label, const vector<cv::Point> & seeds, vector<int> & changed)
+{
+    int n = seeds.size();
+    if (visitBase > INT_MAX - n) {
+        visits.setTo(0);
+        visitBase = 1;
+    }
+
+    // visited pixels of each search, its queue being the pixels from head on
+    vector<vector<cv::Point>> visited(n);
+    vector<size_t> head(n, 0);
+    // union-find forest of the groups, with the number of pixels left in their queues
+    vector<int> group(n), pending(n, 1);
+    vector<bool> finished(n, false);
+    for (int i = 0; i < n; i++) {
+        group[i] = i;
+        visited[i].push_back(seeds[i]);
+        visits.at<int>(seeds[i]) = visitBase + i;
+    }
+    auto find = [&](int i) {
+        while (group[i] != i) {
+            group[i] = group[group[i]];
+            i = group[i];
+        }
+        return i;
+    };
+
+    int alive = n;
+    while (alive > 1) {
+        for (int i = 0; i < n && alive > 1; i++) {
+            if (head[i] == visited[i].size())
+                continue;
+            cv::Point p = visited[i][head[i]++];
+            int root = find(i);
+            pending[root]--;
+            forEachNeighbour(p, [&](cv::Point q) {
+                if (labelImage.at<int>(q) != label)
+                    return;
+                int & visit = visits.at<int>(q);
+                if (visit >= visitBase) {
+                    int other = find(visit - visitBase);
+                    if (other != root) {
+                        group[other] = root;
+                        pending[root] += pending[other];
+                        alive--;
                     }
+                } else {
+                    visit = visitBase + i;
+                    visited[i].push_back(q);
+                    pending[root]++;
                 }
+            });
+            if (pending[root] == 0 && alive > 1) {
+                finished[root] = true;
+                alive--;
             }
         }
     }
 
-    // Réaffecter les labels
-    std::map<int, int> newLabels;
-    int newLabel = 1;
-    for (int y = 0; y < numRows; y++) {
-        for (int x = 0; x < numCols; x++) {
-            if (labels[y][x] != 0) {
-                int rootLabel = labels[y][x];
+    vector<int> pieceLabel(n, 0);
+    for (int i = 0; i < n; i++) {
+        int root = find(i);
+        if (!finished[root])
+            continue;
+        if (pieceLabel[root] == 0) {
+            pieceLabel[root] = newLabel();
+            changed.push_back(pieceLabel[root]);
+        }
+        for (cv::Point p : visited[i])
+            labelImage.at<int>(p) = pieceLabel[root];
+        areas[pieceLabel[root]] += visited[i].size();
+        areas[label] -= visited[i].size();
+    }
+    visitBase += n;
+}
 
-                while (labelEquivalences.find(rootLabel) != labelEquivalences.end()) {
-                    rootLabel = labelEquivalences[rootLabel];
-                }
+/**
+    Removed pixels are cleared first, then every component losing pixels is split from
+    the neighbours of the removed pixels left in it (see splitComponent). An added pixel
+    takes the label of the largest component around it, the other ones being merged into it.
+*/
+vector<int> DynamicLabeling::update(const vector<cv::Point> & pixels, bool present)
+{
+    vector<int> changed;
+    auto inside = [&](cv::Point p) {
+        return p.x >= 0 && p.y >= 0 && p.x < labelImage.cols && p.y < labelImage.rows;
+    };
 
-                if (newLabels.find(rootLabel) == newLabels.end()) {
-                    newLabels[rootLabel] = newLabel;
-                    newLabel++;
+    if (present) {
+        for (cv::Point p : pixels) {
+            if (!inside(p) || labelImage.at<int>(p) != 0)
+                continue;
+            int label = 0;
+            forEachNeighbour(p, [&](cv::Point q) {
+                int l = labelImage.at<int>(q);
+                if (l != 0 && (label == 0 || areas[l] > areas[label]))
+                    label = l;
+            });
+            if (label == 0)
+                label = newLabel();
+            forEachNeighbour(p, [&](cv::Point q) {
+                int l = labelImage.at<int>(q);
+                if (l != 0 && l != label) {
+                    areas[label] += areas[l];
+                    changed.push_back(l);
+                    freeLabel(l);
+                    relabelComponent(q, label);
                 }
+            });
+            labelImage.at<int>(p) = label;
+            areas[label]++;
+            changed.push_back(label);
+        }
+    } else {
+        vector<cv::Point> removed;
+        for (cv::Point p : pixels) {
+            if (!inside(p) || labelImage.at<int>(p) == 0)
+                continue;
+            int & label = labelImage.at<int>(p);
+            changed.push_back(label);
+            if (--areas[label] == 0)
+                freeLabel(label);
+            label = 0;
+            removed.push_back(p);
+        }
+
+        // remaining neighbours of the removed pixels, sorted by component
+        vector<std::pair<int, cv::Point>> seeds;
+        for (cv::Point p : removed)
+            forEachNeighbour(p, [&](cv::Point q) {
+                int l = labelImage.at<int>(q);
+                if (l != 0)
+                    seeds.push_back(std::make_pair(l, q));
+            });
+        std::sort(seeds.begin(), seeds.end(), [](const std::pair<int, cv::Point> & a, const std::pair<int, cv::Point> & b) {
+            return std::make_tuple(a.first, a.second.y, a.second.x) < std::make_tuple(b.first, b.second.y, b.second.x);
+        });
+        seeds.erase(std::unique(seeds.begin(), seeds.end()), seeds.end());
 
-                labels[y][x] = newLabels[rootLabel];
+        vector<cv::Point> componentSeeds;
+        for (size_t s = 0; s < seeds.size(); s++) {
+            componentSeeds.push_back(seeds[s].second);
+            if (s + 1 == seeds.size() || seeds[s + 1].first != seeds[s].first) {
+                if (componentSeeds.size() > 1)
+                    splitComponent(seeds[s].first, componentSeeds, changed);
+                componentSeeds.clear();
+            }
+        }
+    }
+
+    std::sort(changed.begin(), changed.end());
+    changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+    return changed;
+}
+
+/**
+    Pixels sorted by increasing key with a least significant digit radix sort, 8 bits per
+    pass, the keys having keyBits bits: 8 bit keys are sorted by a single counting pass.
+    The sort is stable, so equal keys stay in raster order.
+*/
+static vector<int> radixSortPixels(const vector<unsigned int> & keys, int keyBits)
+{
+    size_t n = keys.size();
+    vector<int> order(n), sorted(n);
+    for (size_t i = 0; i < n; i++)
+        order[i] = i;
+    for (int shift = 0; shift < keyBits; shift += 8) {
+        size_t start[257] = {0};
+        for (size_t i = 0; i < n; i++)
+            start[((keys[i] >> shift) & 255) + 1]++;
+        if (start[((keys[0] >> shift) & 255) + 1] == n)
+            continue;   // same digit everywhere
+        for (int d = 0; d < 256; d++)
+            start[d + 1] += start[d];
+        for (size_t i = 0; i < n; i++)
+            sorted[start[(keys[order[i]] >> shift) & 255]++] = order[i];
+        order.swap(sorted);
+    }
+    return order;
+}
+
+/**
+    The pixels are merged from the leaves (last pixels of order) to the root: each pixel
+    becomes the root of the union-find trees of its neighbours already merged, and their
+    parent in the component tree. The parents are then made canonical from the root.
+*/
+ComponentTree::ComponentTree(cv::Mat image, ComponentTreeType type, Connectivity connectivity)
+    : rows(image.rows), cols(image.cols), imageType(image.type()), nodeCount(0)
+{
+    CV_Assert(image.type() == CV_32FC1 || image.type() == CV_8UC1);
+    size_t n = image.total();
+    values.resize(n);
+    if (n == 0)
+        return;
+
+    // keys ordered like the values (reversed for a min tree): the 8 bit levels when the
+    // image holds 8 bit data, else the bits of the floats, -0 being 0
+    vector<unsigned int> keys(n);
+    Mat levels;
+    if (image.type() == CV_8UC1)
+        levels = image;
+    if (!levels.empty() || quantizedLevels(image, levels)) {
+        for (int y = 0; y < rows; y++) {
+            const uchar * level = levels.ptr<uchar>(y);
+            for (int x = 0; x < cols; x++) {
+                keys[y * cols + x] = (type == MAX_TREE) ? level[x] : 255 - level[x];
+                values[y * cols + x] = (image.type() == CV_8UC1) ? level[x] : image.at<float>(y, x);
+            }
+        }
+        order = radixSortPixels(keys, 8);
+    } else {
+        for (int y = 0; y < rows; y++) {
+            const float * in = image.ptr<float>(y);
+            for (int x = 0; x < cols; x++) {
+                float v = (in[x] == 0) ? 0.0f : in[x];
+                unsigned int bits;
+                memcpy(&bits, &v, sizeof(bits));
+                bits = (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+                keys[y * cols + x] = (type == MAX_TREE) ? bits : ~bits;
+                values[y * cols + x] = in[x];
             }
         }
+        order = radixSortPixels(keys, 32);
     }
 
-    cv::Mat result(numRows, numCols, CV_32SC1);
-    for (int y = 0; y < numRows; y++) {
-        for (int x = 0; x < numCols; x++) {
-            result.at<int>(y, x) = labels[y][x];
+    static const int dx[8] = {-1, 1, 0, 0, -1, 1, -1, 1};
+    static const int dy[8] = {0, 0, -1, 1, -1, -1, 1, 1};
+    parent.resize(n);
+    area.assign(n, 1);
+    vector<int> zpar(n, -1);
+    for (size_t i = n; i-- > 0;) {
+        int p = order[i];
+        parent[p] = p;
+        zpar[p] = p;
+        int x = p % cols, y = p / cols;
+        for (int k = 0; k < (int)connectivity; k++) {
+            int nx = x + dx[k], ny = y + dy[k];
+            if (nx < 0 || ny < 0 || nx >= cols || ny >= rows || zpar[ny * cols + nx] < 0)
+                continue;
+            // root with path halving
+            int r = ny * cols + nx;
+            while (zpar[r] != r) {
+                zpar[r] = zpar[zpar[r]];
+                r = zpar[r];
+            }
+            if (r != p) {
+                parent[r] = p;
+                zpar[r] = p;
+                area[p] += area[r];
+            }
         }
     }
 
-    return result;
-}
\ No newline at end of file
+    for (size_t i = 0; i < n; i++) {
+        int p = order[i];
+        int q = parent[p];
+        if (values[parent[q]] == values[q])
+            parent[p] = parent[q];
+        if (p == parent[p] || values[parent[p]] != values[p])
+            nodeCount++;
+    }
+}
+
+cv::Mat ComponentTree::areaFilter(int size) const
+{
+    Mat res(rows, cols, imageType);
+    vector<float> level(order.size());
+    for (int p : order) {
+        int q = parent[p];
+        if (p == q)
+            level[p] = values[p];
+        else if (values[q] == values[p])
+            level[p] = level[q];
+        else
+            level[p] = (area[p] >= size) ? values[p] : level[q];
+    }
+    for (int y = 0; y < rows; y++) {
+        if (imageType == CV_8UC1)
+            std::copy(level.begin() + y * cols, level.begin() + (y + 1) * cols, res.ptr<uchar>(y));
+        else
+            std::copy(level.begin() + y * cols, level.begin() + (y + 1) * cols, res.ptr<float>(y));
+    }
+    return res;
+}
+
+int ComponentTree::nodes() const
+{
+    return nodeCount;
+}
+
+/**
+    Area opening: removes the bright components of area lower than size of every
+    level set, the connected components being given by the connectivity.
+*/
+cv::Mat areaOpening(cv::Mat image, int size, Connectivity connectivity)
+{
+    return ComponentTree(image, MAX_TREE, connectivity).areaFilter(size);
+}
+
+/**
+    Area closing: removes the dark components of area lower than size of every
+    level set, the connected components being given by the connectivity.
+*/
+cv::Mat areaClosing(cv::Mat image, int size, Connectivity connectivity)
+{
+    return ComponentTree(image, MIN_TREE, connectivity).areaFilter(size);
+}
+
+/**
+    Performs a labeling of image connected component with 4 connectivity using a
+    2 pass algorithm.
+    Any non zero pixel of the image is considered as present.
+
+    The first pass writes provisional labels directly in the result and records their
+    equivalences in a flat union-find forest, the second replaces them by the final labels,
+    numbered in raster order of first occurrence: stripLabeling with a single strip.
+*/
+cv::Mat ccLabel2pass(cv::Mat image)
+{
+    return stripLabeling(image, std::max(image.rows, 1), CONNECTIVITY_4, NULL);
+}
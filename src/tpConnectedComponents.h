@@ -1,10 +1,218 @@
-
 #pragma once
 
 #include <opencv2/opencv.hpp>
+#include <vector>
+#include <functional>
+
+/**
+    Neighbourhoods used to connect the pixels of a component (see ccLabel).
+*/
+enum Connectivity {
+    CONNECTIVITY_4 = 4,     // left, right, top and bottom neighbours
+    CONNECTIVITY_8 = 8      // and the 4 diagonal neighbours
+};
+
+/**
+    Statistics of a connected component, accumulated pixel by pixel while labeling.
+*/
+struct ComponentStats
+{
+    int area;
+    int minX, minY, maxX, maxY;     // bounding box, bounds included
+    double sumX, sumY;              // sums of the pixel coordinates
+    double sumIntensity;            // sum of the pixel values of the labeled image
+
+    ComponentStats();
+
+    cv::Rect boundingBox() const;
+    cv::Point2d centroid() const;
+    // area / area of the bounding box, 1 for a filled axis aligned rectangle
+    double fillRatio() const;
+
+    void add(int x, int y, float value);
+    void merge(const ComponentStats & other);
+};
+
+cv::Mat ccLabel(cv::Mat image, Connectivity connectivity=CONNECTIVITY_4);
+
+cv::Mat ccLabel(cv::Mat image, std::vector<ComponentStats> & stats, Connectivity connectivity=CONNECTIVITY_4);
+
+cv::Mat ccLabelLambda(cv::Mat image, float lambda, Connectivity connectivity=CONNECTIVITY_4);
+
+cv::Mat ccLabelLambda(cv::Mat image, float lambda, std::vector<ComponentStats> & stats,
+                      Connectivity connectivity=CONNECTIVITY_4);
+
+/**
+    Connected component labeling of a binary image received row by row, for images too
+    large to be kept in memory: only the runs of present pixels of the last row and the
+    statistics of the components crossing it are stored, so the memory used is
+    proportional to the image width.
+
+    A component is finished when a row does not continue it: finished(stats) is then
+    called with its statistics (see ComponentStats), and finish() ends the image.
+*/
+class StreamingLabeler
+{
+public:
+    StreamingLabeler(int width, std::function<void(const ComponentStats &)> finished,
+                     Connectivity connectivity=CONNECTIVITY_4);
+
+    // adds the next row of width values, non zero values being present pixels
+    void addRow(const float * row);
+
+    // ends the image: the components crossing the last row are finished
+    void finish();
+
+    // number of components crossing the last row
+    int liveComponents() const;
+
+private:
+    // pixels [start, end[ of a row, part of component
+    struct Run
+    {
+        int start, end, component;
+
+        Run(int start, int end) : start(start), end(end), component(-1) {}
+    };
+
+    int width;
+    std::function<void(const ComponentStats &)> finished;
+    Connectivity connectivity;
+    int y;
+    std::vector<Run> previousRuns, runs;
+    // statistics and union-find forest of the components of previousRuns, then of the new ones
+    std::vector<ComponentStats> components;
+    std::vector<int> parent;
+
+    int find(int component);
+    int unite(int a, int b);
+};
+
+/**
+    Run of the pixels [start, end[ of a row, part of the component of the given label.
+*/
+struct LabelRun
+{
+    int start, end, label;
+};
+
+/**
+    Labels of the connected components of a binary image stored as runs of present pixels
+    (see ccLabelRuns): the runs of row y are runs[rowStart[y]] to runs[rowStart[y + 1] - 1],
+    from left to right. The labels go from 1 to components.
+*/
+struct RunLengthLabels
+{
+    int rows, cols;
+    std::vector<int> rowStart;
+    std::vector<LabelRun> runs;
+    int components;
+
+    // label image of type CV_32SC1, 0 outside the runs
+    cv::Mat toImage() const;
+};
+
+RunLengthLabels ccLabelRuns(cv::Mat image, Connectivity connectivity=CONNECTIVITY_4);
+
+/**
+    Labels of the connected components of a binary image kept up to date while pixels are
+    added or removed, for editing a mask without labeling the whole image again.
+
+    The work done by an edit depends on the components it touches, not on the image size:
+    a component split by removed pixels is explored from the neighbours of these pixels
+    all at once, stopping when a single piece is left unexplored, and merged components
+    are relabeled into the largest of them. So the cost is the area of the smaller pieces.
+
+    The labels are stable across edits but not consecutive: the label of a removed
+    component is reused for the next new one.
+*/
+class DynamicLabeling
+{
+public:
+    DynamicLabeling(cv::Mat image, Connectivity connectivity=CONNECTIVITY_4);
+
+    // adds (present) or removes the given pixels, ignoring those outside the image, and
+    // returns the sorted labels whose pixels changed (new, grown, shrunk, split or removed)
+    std::vector<int> update(const std::vector<cv::Point> & pixels, bool present);
+
+    // label image of type CV_32SC1, 0 for the absent pixels
+    const cv::Mat & labels() const;
+
+    // area of the component of the given label, 0 for an unused label
+    int area(int label) const;
+
+    // number of connected components
+    int components() const;
+
+private:
+    Connectivity connectivity;
+    cv::Mat labelImage;
+    std::vector<int> areas;
+    std::vector<int> freeLabels;
+    // stamps of the pixels visited by the searches of splitComponent: visitBase + search index
+    cv::Mat visits;
+    int visitBase;
+
+    int newLabel();
+    void freeLabel(int label);
+    template<typename NeighbourFunction>
+    void forEachNeighbour(cv::Point p, NeighbourFunction f) const;
+    void relabelComponent(cv::Point seed, int label);
+    void splitComponent(int label, const std::vector<cv::Point> & seeds, std::vector<int> & changed);
+};
+
+cv::Mat ccAreaFilter(cv::Mat image, int size, Connectivity connectivity=CONNECTIVITY_4);
+
+cv::Mat detectRectangle(cv::Mat image, float tolerance=0.1f, Connectivity connectivity=CONNECTIVITY_4);
+
+cv::Mat detectRectangle(cv::Mat image, std::vector<cv::Rect> & rectangles, float tolerance=0.1f,
+                        Connectivity connectivity=CONNECTIVITY_4);
+
+/**
+    Kinds of component trees (see ComponentTree).
+*/
+enum ComponentTreeType {
+    MAX_TREE,   // components of the upper level sets, bright regions nested in darker ones
+    MIN_TREE    // components of the lower level sets, dark regions nested in brighter ones
+};
+
+/**
+    Component tree of a grayscale image: its nodes are the connected components of every
+    level set of the image, each one included in its parent. It is built once by a radix
+    sort of the pixels followed by a union-find pass from the leaves (Najman and Couprie),
+    then filtering the components by area takes linear time for any size.
+
+    The image is of type CV_32FC1 or CV_8UC1. 8 bit images, and float images holding 8 bit
+    data (see quantizedLevels), are sorted by a single counting pass over the 256 levels
+    instead of the 4 passes needed for floats.
+*/
+class ComponentTree
+{
+public:
+    ComponentTree(cv::Mat image, ComponentTreeType type=MAX_TREE, Connectivity connectivity=CONNECTIVITY_4);
+
+    // every pixel takes the level of its smallest component of area at least size: an
+    // area opening for a max tree, an area closing for a min tree, of the type of the image
+    cv::Mat areaFilter(int size) const;
+
+    // number of nodes of the tree
+    int nodes() const;
+
+private:
+    int rows, cols, imageType;
+    std::vector<float> values;
+    // pixels (y * cols + x) from the root level to the leaves
+    std::vector<int> order;
+    // first pixel in order of the node of each pixel, or of the parent node for these
+    // canonical pixels, the root being its own parent
+    std::vector<int> parent;
+    // area of the node of each canonical pixel
+    std::vector<int> area;
+    int nodeCount;
+};
 
-cv::Mat ccLabel(cv::Mat image);
+cv::Mat areaOpening(cv::Mat image, int size, Connectivity connectivity=CONNECTIVITY_4);
 
-cv::Mat ccAreaFilter(cv::Mat image, int size);
+cv::Mat areaClosing(cv::Mat image, int size, Connectivity connectivity=CONNECTIVITY_4);
 
 cv::Mat ccLabel2pass(cv::Mat image);
\ No newline at end of file
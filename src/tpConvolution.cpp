@@ -1,49 +1,47 @@
 
 #include "tpConvolution.h"
+#include "common.h"
+#include "neighbourhood.h"
 #include <cmath>
 #include <algorithm>
 #include <tuple>
+#include <iostream>
 using namespace cv;
 using namespace std;
 /**
     Compute a mean filter of size 2k+1.
 
     Pixel values outside of the image domain are supposed to have a zero value.
+
+    The window sums are read from a summed-area table of the image (see integralImage),
+    so the cost per pixel does not depend on k. Windows crossing the image border
+    are clipped to the image domain but still divided by the full window area.
 */
 cv::Mat meanFilter(cv::Mat image, int k){
-    Mat res = image.clone();
+    Mat res(image.size(), CV_32FC1);
     /********************************************
                 YOUR CODE HERE
     *********************************************/
-    int debut= 0;
-    int taille = (2 * k + 1);
-    int taille_fen_carre = taille * taille;
-    while (debut< image.rows) {
-        int fin= 0;
-        while (fin< image.cols) {
-            int ligne_min = (debut- k) < 0 ? 0 : (debut- k);
-            int ligne_max = (debut+ k) > (image.rows - 1) ? (image.rows - 1) : (debut+ k);
-            int colonne_min = (fin- k) < 0 ? 0 : (fin- k);
-            int colonne_max = (fin+ k) > (image.cols - 1) ? (image.cols - 1) : (fin+ k);
-            float sommePix = 0;
-            int taille_fen_actuelle = 0;
-
-            int x = ligne_min;
-            while (x <= ligne_max) {
-                int y = colonne_min;
-                while (y <= colonne_max) {
-                    sommePix += image.at<float>(x, y);
-                    taille_fen_actuelle++;
-                    y++;
-                }
-                x++;
+    Mat sat = integralImage(image);
+    float windowArea = (float)((2 * k + 1) * (2 * k + 1));
+
+    parallelRows(image.rows, [&](int rowStart, int rowEnd) {
+        for (int y = rowStart; y < rowEnd; y++) {
+            // rows [rowMin, rowMax[ of the window, clipped to the image
+            int rowMin = std::max(y - k, 0);
+            int rowMax = std::min(y + k + 1, image.rows);
+            const double * top = sat.ptr<double>(rowMin);
+            const double * bottom = sat.ptr<double>(rowMax);
+            float * out = res.ptr<float>(y);
+
+            for (int x = 0; x < image.cols; x++) {
+                int colMin = std::max(x - k, 0);
+                int colMax = std::min(x + k + 1, image.cols);
+                double windowSum = bottom[colMax] - bottom[colMin] - top[colMax] + top[colMin];
+                out[x] = (float)windowSum / windowArea;
             }
-            float moyenne = sommePix /(float)(taille_fen_carre);
-            res.at<float>(debut, fin) = moyenne;
-            fin+=1;
         }
-        debut+=1;
-    }
+    });
     /********************************************
                 END OF YOUR CODE
     *********************************************/
@@ -51,51 +49,278 @@ cv::Mat meanFilter(cv::Mat image, int k){
     return res;
 }
 
+/**
+    Singular values of a kernel smaller than KERNEL_RANK_TOLERANCE times its largest
+    singular value are considered null when computing its separable decomposition.
+*/
+static const double KERNEL_RANK_TOLERANCE = 1e-6;
+
+/**
+    Decompose a kernel as a sum of separable kernels using its singular value decomposition:
+        kernel = sum_i columnFilters[i] * rowFilters[i]
+    where columnFilters[i] is a column vector and rowFilters[i] is a row vector (CV_32FC1).
+
+    Returns the numerical rank of the kernel, ie. the number of terms of the sum.
+*/
+static int separableDecomposition(Mat kernel, vector<Mat> & columnFilters, vector<Mat> & rowFilters)
+{
+    Mat kernel64;
+    kernel.convertTo(kernel64, CV_64F);
+    SVD svd(kernel64);
+
+    columnFilters.clear();
+    rowFilters.clear();
+    double largest = svd.w.at<double>(0, 0);
+    for (int i = 0; i < svd.w.rows; i++) {
+        double singularValue = svd.w.at<double>(i, 0);
+        if (singularValue <= largest * KERNEL_RANK_TOLERANCE)
+            break;
+        Mat column, row;
+        Mat(svd.u.col(i) * singularValue).convertTo(column, CV_32F);
+        svd.vt.row(i).convertTo(row, CV_32F);
+        columnFilters.push_back(column);
+        rowFilters.push_back(row);
+    }
+    return (int)columnFilters.size();
+}
+
+/**
+    Direct convolution: every coefficient of the kernel is applied to every pixel.
+
+    Pixel values outside of the image domain are supposed to have a zero value.
+
+    Only the pixels of the border band check the bounds of the image, the interior
+    is processed by vectors of pixels (see forEachPixelSplit).
+*/
+static Mat denseConvolution(Mat image, Mat kernel)
+{
+    Mat res(image.size(), CV_32FC1);
+    int radiusY = kernel.rows / 2;
+    int radiusX = kernel.cols / 2;
+    NeighbourhoodExtent extent(radiusY, kernel.rows - 1 - radiusY, radiusX, kernel.cols - 1 - radiusX);
+
+    auto border = [&](int y, int x) {
+        float sum = 0;
+        for (int a = -radiusY; a < kernel.rows - radiusY; a++) {
+            if (y + a < 0 || y + a >= image.rows)
+                continue;
+            const float * in = image.ptr<float>(y + a);
+            const float * coefficients = kernel.ptr<float>(a + radiusY);
+            for (int b = -radiusX; b < kernel.cols - radiusX; b++)
+                if (x + b >= 0 && x + b < image.cols)
+                    sum += in[x + b] * coefficients[b + radiusX];
+        }
+        res.ptr<float>(y)[x] = sum;
+    };
+
+    auto interiorRow = [&](int y, int xStart, int xEnd) -> int {
+        float * out = res.ptr<float>(y);
+        int x = xStart;
+        for (; x + VFLOAT_WIDTH <= xEnd; x += VFLOAT_WIDTH) {
+            vfloat sum = vset(0);
+            for (int a = 0; a < kernel.rows; a++) {
+                const float * in = image.ptr<float>(y + a - radiusY) + x - radiusX;
+                const float * coefficients = kernel.ptr<float>(a);
+                for (int b = 0; b < kernel.cols; b++)
+                    sum = vadd(sum, vmul(vload(in + b), vset(coefficients[b])));
+            }
+            vstore(out + x, sum);
+        }
+        return x;
+    };
+
+    parallelRows(image.rows, [&](int rowStart, int rowEnd) {
+        forEachPixelSplit(image.size(), extent, rowStart, rowEnd, border, interiorRow);
+    });
+    return res;
+}
+
+/**
+    Convolution by a sum of separable kernels (see separableDecomposition): each term
+    is applied as a horizontal 1D pass followed by a vertical 1D pass, so a KxK kernel
+    of rank r costs 2*r*K operations per pixel instead of K*K.
+
+    Pixel values outside of the image domain are supposed to have a zero value.
+*/
+static Mat separableConvolution(Mat image, const vector<Mat> & columnFilters, const vector<Mat> & rowFilters)
+{
+    Mat res = Mat::zeros(image.size(), CV_32FC1);
+    Mat tmp(image.size(), CV_32FC1);
+
+    for (size_t i = 0; i < columnFilters.size(); i++) {
+        const float * column = columnFilters[i].ptr<float>(0);
+        const float * row = rowFilters[i].ptr<float>(0);
+        int columnSize = columnFilters[i].rows;
+        int rowSize = rowFilters[i].cols;
+        int radiusY = columnSize / 2;
+        int radiusX = rowSize / 2;
+
+        // horizontal pass
+        parallelRows(image.rows, [&](int rowStart, int rowEnd) {
+            forEachPixelSplit(image.size(), NeighbourhoodExtent(0, 0, radiusX, rowSize - 1 - radiusX), rowStart, rowEnd,
+                [&](int y, int x) {
+                    const float * in = image.ptr<float>(y);
+                    int first = std::max(-radiusX, -x);
+                    int last = std::min(rowSize - 1 - radiusX, image.cols - 1 - x);
+                    float sum = 0;
+                    for (int b = first; b <= last; b++)
+                        sum += in[x + b] * row[b + radiusX];
+                    tmp.ptr<float>(y)[x] = sum;
+                },
+                [&](int y, int xStart, int xEnd) -> int {
+                    float * out = tmp.ptr<float>(y);
+                    int x = xStart;
+                    for (; x + VFLOAT_WIDTH <= xEnd; x += VFLOAT_WIDTH) {
+                        const float * in = image.ptr<float>(y) + x - radiusX;
+                        vfloat sum = vset(0);
+                        for (int b = 0; b < rowSize; b++)
+                            sum = vadd(sum, vmul(vload(in + b), vset(row[b])));
+                        vstore(out + x, sum);
+                    }
+                    return x;
+                });
+        });
+
+        // vertical pass, accumulated into the result (once the whole horizontal pass is done)
+        parallelRows(image.rows, [&](int rowStart, int rowEnd) {
+            forEachPixelSplit(image.size(), NeighbourhoodExtent(radiusY, columnSize - 1 - radiusY, 0, 0), rowStart, rowEnd,
+                [&](int y, int x) {
+                    int first = std::max(-radiusY, -y);
+                    int last = std::min(columnSize - 1 - radiusY, image.rows - 1 - y);
+                    float sum = 0;
+                    for (int a = first; a <= last; a++)
+                        sum += tmp.ptr<float>(y + a)[x] * column[a + radiusY];
+                    res.ptr<float>(y)[x] += sum;
+                },
+                [&](int y, int xStart, int xEnd) -> int {
+                    float * out = res.ptr<float>(y);
+                    int x = xStart;
+                    for (; x + VFLOAT_WIDTH <= xEnd; x += VFLOAT_WIDTH) {
+                        vfloat sum = vset(0);
+                        for (int a = 0; a < columnSize; a++)
+                            sum = vadd(sum, vmul(vload(tmp.ptr<float>(y + a - radiusY) + x), vset(column[a])));
+                        vstore(out + x, vadd(vload(out + x), sum));
+                    }
+                    return x;
+                });
+        });
+    }
+
+    return res;
+}
+
+FFTConvolution::FFTConvolution(cv::Mat image) : image(image)
+{
+}
+
+/**
+    Convolution of the image by kernel, same result as convolution(image, kernel).
+
+    The image and the kernel are zero padded to a size where the circular correlation
+    computed by the Fourier transforms equals the zero padded linear one.
+*/
+cv::Mat FFTConvolution::apply(cv::Mat kernel)
+{
+    int rows = getOptimalDFTSize(image.rows + kernel.rows - 1);
+    int cols = getOptimalDFTSize(image.cols + kernel.cols - 1);
+    if (spectrum.empty() || spectrum.rows < rows || spectrum.cols < cols) {
+        Mat padded;
+        copyMakeBorder(image, padded, 0, rows - image.rows, 0, cols - image.cols, BORDER_CONSTANT, Scalar::all(0));
+        dft(padded, spectrum, DFT_COMPLEX_OUTPUT);
+    }
+    rows = spectrum.rows;
+    cols = spectrum.cols;
+
+    Mat paddedKernel = Mat::zeros(rows, cols, CV_32FC1);
+    kernel.copyTo(paddedKernel(Rect(0, 0, kernel.cols, kernel.rows)));
+    Mat kernelSpectrum, product, correlation;
+    dft(paddedKernel, kernelSpectrum, DFT_COMPLEX_OUTPUT);
+    mulSpectrums(spectrum, kernelSpectrum, product, 0, true);
+    dft(product, correlation, DFT_INVERSE | DFT_SCALE | DFT_REAL_OUTPUT);
+
+    // correlation(y, x) = sum of image(y + a, x + b) * kernel(a, b): shift by the kernel radius
+    int radiusY = kernel.rows / 2;
+    int radiusX = kernel.cols / 2;
+    Mat res(image.size(), CV_32FC1);
+    parallelRows(image.rows, [&](int rowStart, int rowEnd) {
+        for (int y = rowStart; y < rowEnd; y++) {
+            const float * in = correlation.ptr<float>((y - radiusY + rows) % rows);
+            float * out = res.ptr<float>(y);
+            for (int x = 0; x < image.cols; x++)
+                out[x] = in[(x - radiusX + cols) % cols];
+        }
+    });
+    return res;
+}
+
+/**
+    Estimated number of operations of a FFT of size n, relative to one multiply-add
+    of the direct convolution.
+*/
+static double fftCost(double n)
+{
+    return 2.0 * n * std::log2(n);
+}
+
+/**
+    Cost model of the convolution of an image by a kernel of the given rank:
+    returns the backend with the smallest estimated number of operations.
+*/
+static ConvolutionBackend selectConvolutionBackend(Size imageSize, Size kernelSize, int rank)
+{
+    double pixels = (double)imageSize.area();
+    double directCost = pixels * kernelSize.area();
+    double separableCost = pixels * rank * (kernelSize.width + kernelSize.height);
+    double paddedPixels = (double)getOptimalDFTSize(imageSize.height + kernelSize.height - 1)
+                          * getOptimalDFTSize(imageSize.width + kernelSize.width - 1);
+    // forward transforms of the image and of the kernel, product, and inverse transform
+    double fftConvolutionCost = 3 * fftCost(paddedPixels) + paddedPixels;
+
+    if (fftConvolutionCost < directCost && fftConvolutionCost < separableCost)
+        return CONVOLUTION_FFT;
+    if (separableCost < directCost)
+        return CONVOLUTION_SEPARABLE;
+    return CONVOLUTION_DIRECT;
+}
+
 /**
     Compute the convolution of a float image by kernel.
     Result has the same size as image.
     
     Pixel values outside of the image domain are supposed to have a zero value.
+
+    With CONVOLUTION_AUTO, the kernel is first decomposed as a sum of separable kernels
+    and a cost model chooses between the direct, separable (see separableConvolution)
+    and Fourier (see FFTConvolution) algorithms according to the image size, the kernel
+    size and its rank. Any other backend forces the corresponding algorithm.
+
+    Nothing is kept between calls: the Fourier backend transforms the image every time
+    (see FFTConvolution to reuse that transform for several kernels).
 */
-Mat convolution(Mat image, cv::Mat kernel)
+Mat convolution(Mat image, cv::Mat kernel, ConvolutionBackend backend)
 {
-    Mat res = image.clone();
     /********************************************
                 YOUR CODE HERE
     *********************************************/
-    int noeud= kernel.rows/2;
-    int debut = 0;
-    while (debut< image.rows) {
-        int fin= 0;
-        while (fin< image.cols) {
-            int x= -noeud;
-            float sommePix=0;
-
-            while (x<= noeud) {
-                int y= -noeud;
-                while (y<= noeud) {
-                    bool coordonneesValides = (debut + x >= 0 && fin+ y >= 0 && debut + x < image.rows && fin+ y < image.cols);
-                    if (coordonneesValides) {
-                        float pixelIm = image.at<float>(debut+ x, fin+ y);
-                        float pixelNoy = kernel.at<float>(x + noeud, y + noeud);
-                        sommePix += pixelIm * pixelNoy;
-                    }
-                    y+=1;
-                }
-                x+=1;
-            }
-            res.at<float>(debut, fin) = sommePix;
-            fin++;
-        }
-        debut+=1;
+    vector<Mat> columnFilters, rowFilters;
+    if (backend == CONVOLUTION_AUTO || backend == CONVOLUTION_SEPARABLE) {
+        int rank = separableDecomposition(kernel, columnFilters, rowFilters);
+        if (backend == CONVOLUTION_AUTO)
+            backend = selectConvolutionBackend(image.size(), kernel.size(), rank);
     }
 
-    return res;
+    switch (backend) {
+        case CONVOLUTION_SEPARABLE:
+            return separableConvolution(image, columnFilters, rowFilters);
+        case CONVOLUTION_FFT:
+            // one-off: callers filtering the same image again keep their own FFTConvolution
+            return FFTConvolution(image).apply(kernel);
+        default:
+            return denseConvolution(image, kernel);
+    }
     /********************************************
                 END OF YOUR CODE
     *********************************************/
-
-    return res;
 }
 
 /**
@@ -108,27 +333,52 @@ cv::Mat edgeSobel(cv::Mat image)
     cv::Mat Gx = (cv::Mat_<float>(3, 3) << -1, 0, 1, -2, 0, 2, -1, 0, 1);
     cv::Mat Gy = (cv::Mat_<float>(3, 3) << -1, -2, -1, 0, 0, 0, 1, 2, 1);
 
-    for (int i = 0; i < image.rows; i++) {
-        for (int j = 0; j < image.cols; j++) {
-            float xGradient = 0.0;
-            float yGradient = 0.0;
+    auto border = [&](int i, int j) {
+        float xGradient = 0.0;
+        float yGradient = 0.0;
+
+        for (int x = -1; x <= 1; x++) {
+            for (int y = -1; y <= 1; y++) {
+                int newX = i + x;
+                int newY = j + y;
+
+                if (newX >= 0 && newX < image.rows && newY >= 0 && newY < image.cols) {
+                    xGradient += image.at<float>(newX, newY) * Gx.at<float>(x + 1, y + 1);
+                    yGradient += image.at<float>(newX, newY) * Gy.at<float>(x + 1, y + 1);
+                }
+            }
+        }
+
+        float gradientMagnitude = std::abs(xGradient) + std::abs(yGradient);
+        res.at<float>(i, j) = gradientMagnitude;
+    };
+
+    auto interiorRow = [&](int i, int jStart, int jEnd) -> int {
+        float * out = res.ptr<float>(i);
+        int j = jStart;
+        for (; j + VFLOAT_WIDTH <= jEnd; j += VFLOAT_WIDTH) {
+            vfloat xGradient = vset(0);
+            vfloat yGradient = vset(0);
 
             for (int x = -1; x <= 1; x++) {
+                const float * in = image.ptr<float>(i + x) + j;
+                const float * gx = Gx.ptr<float>(x + 1);
+                const float * gy = Gy.ptr<float>(x + 1);
                 for (int y = -1; y <= 1; y++) {
-                    int newX = i + x;
-                    int newY = j + y;
-
-                    if (newX >= 0 && newX < image.rows && newY >= 0 && newY < image.cols) {
-                        xGradient += image.at<float>(newX, newY) * Gx.at<float>(x + 1, y + 1);
-                        yGradient += image.at<float>(newX, newY) * Gy.at<float>(x + 1, y + 1);
-                    }
+                    vfloat pixel = vload(in + y);
+                    xGradient = vadd(xGradient, vmul(pixel, vset(gx[y + 1])));
+                    yGradient = vadd(yGradient, vmul(pixel, vset(gy[y + 1])));
                 }
             }
 
-            float gradientMagnitude = std::abs(xGradient) + std::abs(yGradient);
-            res.at<float>(i, j) = gradientMagnitude;
+            vstore(out + j, vadd(vabs(xGradient), vabs(yGradient)));
         }
-    }
+        return j;
+    };
+
+    parallelRows(image.rows, [&](int rowStart, int rowEnd) {
+        forEachPixelSplit(image.size(), NeighbourhoodExtent(1, 1, 1, 1), rowStart, rowEnd, border, interiorRow);
+    });
 
     return res;
 }
@@ -141,40 +391,256 @@ float gaussian(float x, float sigma2)
     return 1.0/(2*M_PI*sigma2)*exp(-x*x/(2*sigma2));
 }
 
+// bilateral grids up to this number of cells (8 bytes each) are allowed even on small images
+static const double BILATERAL_GRID_MIN_CELLS = 1 << 22;
+
+/**
+    Approximation of the bilateral filter with a bilateral grid (Paris and Durand; Chen, Paris
+    and Durand): the pixels are accumulated (splat) as (value, 1) in a coarse 3D grid of
+    space and intensity, the grid is blurred, and each pixel reads back (slice) the ratio of
+    the two blurred channels at its position.
+
+    The spatial kernel is replaced by a gaussian of the same variance. Splat and slice use
+    trilinear interpolation and the blur the binomial filter [1 4 6 4 1]/16 along each axis:
+    the resulting kernel has a variance of 4/3 squared cells, so the cells measure
+    sqrt(3/4) times the spatial and intensity standard deviations (but at least one pixel).
+    The cost is a constant number of operations per pixel plus the size of the grid, and does
+    not depend on the size of the spatial kernel.
+
+    Error bound: along each axis, the weight given by the grid to a neighbour differs from
+    the gaussian weight of the same variance by less than 10% of the peak gaussian weight,
+    whatever the sub-cell positions of the two pixels. All the weights are positive, so the
+    result always lies between the minimum and the maximum values of the image.
+
+    Small spatial or intensity scales give a grid with more cells than the image has pixels,
+    which would be both larger and slower than the exact filter: when the grid has more than
+    max(pixels, BILATERAL_GRID_MIN_CELLS) cells, an empty matrix is returned instead.
+    The spatial standard deviation is measured on the kernel, whose sum must not be zero.
+*/
+static cv::Mat bilateralGrid(cv::Mat image, cv::Mat kernel, float sigma_r)
+{
+    // for an isotropic gaussian of standard deviation sigma, E[dx^2 + dy^2] = 2 sigma^2
+    double moment = 0, mass = 0;
+    for (int ky = 0; ky < kernel.rows; ky++)
+        for (int kx = 0; kx < kernel.cols; kx++) {
+            double dy = ky - kernel.rows / 2;
+            double dx = kx - kernel.cols / 2;
+            double w = kernel.at<float>(ky, kx);
+            moment += w * (dx * dx + dy * dy);
+            mass += w;
+        }
+    CV_Assert(mass != 0);
+    double sigma_s = std::sqrt(moment / (2 * mass));
+
+    double minValue, maxValue;
+    cv::minMaxLoc(image, &minValue, &maxValue);
+
+    const int PAD = 2;  // support of the blur
+    double spatialCell = std::max(1.0, std::sqrt(0.75) * sigma_s);
+    double rangeCell = std::sqrt(0.75) * sigma_r;
+    // grid sizes in double first: a tiny rangeCell would overflow an int
+    double widthCells = std::floor((image.cols - 1) / spatialCell) + 2 + 2 * PAD;
+    double heightCells = std::floor((image.rows - 1) / spatialCell) + 2 + 2 * PAD;
+    double depthCells = std::floor((maxValue - minValue) / rangeCell) + 2 + 2 * PAD;
+    if (!(widthCells * heightCells * depthCells <= std::max((double)image.total(), BILATERAL_GRID_MIN_CELLS)))
+        return cv::Mat();
+    int gridWidth = (int)widthCells;
+    int gridHeight = (int)heightCells;
+    int gridDepth = (int)depthCells;
+
+    // grid[((gy * gridWidth + gx) * gridDepth + gz) * 2 + c]: c = 0 for the values, 1 for the weights
+    std::vector<float> grid((size_t)gridHeight * gridWidth * gridDepth * 2, 0.0f);
+    auto cell = [&](int gy, int gx, int gz) -> float * {
+        return grid.data() + (((size_t)gy * gridWidth + gx) * gridDepth + gz) * 2;
+    };
+
+    // grid position of a pixel, split in integer cell and fractional part
+    auto position = [&](int y, int x, float v, int * cells, float * fractions) {
+        double coordinates[3] = {y / spatialCell + PAD, x / spatialCell + PAD, (v - minValue) / rangeCell + PAD};
+        for (int k = 0; k < 3; k++) {
+            cells[k] = (int)coordinates[k];
+            fractions[k] = (float)(coordinates[k] - cells[k]);
+        }
+    };
+
+    // the splat accumulates into shared cells: it stays sequential so that the sums
+    // do not depend on the number of threads
+    for (int y = 0; y < image.rows; y++) {
+        const float * in = image.ptr<float>(y);
+        for (int x = 0; x < image.cols; x++) {
+            int cells[3];
+            float fractions[3];
+            position(y, x, in[x], cells, fractions);
+            for (int corner = 0; corner < 8; corner++) {
+                float w = 1;
+                for (int k = 0; k < 3; k++)
+                    w *= ((corner >> k) & 1) ? fractions[k] : 1 - fractions[k];
+                float * c = cell(cells[0] + (corner & 1), cells[1] + ((corner >> 1) & 1), cells[2] + ((corner >> 2) & 1));
+                c[0] += w * in[x];
+                c[1] += w;
+            }
+        }
+    }
+
+    // separable binomial blur along each of the 3 axes, zero outside the grid
+    const float binomial[5] = {1 / 16.0f, 4 / 16.0f, 6 / 16.0f, 4 / 16.0f, 1 / 16.0f};
+    int sizes[3] = {gridHeight, gridWidth, gridDepth};
+    size_t strides[3] = {(size_t)gridWidth * gridDepth * 2, (size_t)gridDepth * 2, 2};
+    for (int axis = 0; axis < 3; axis++) {
+        int n = sizes[axis];
+        size_t stride = strides[axis];
+        int first = (axis + 1) % 3;
+        int second = (axis + 2) % 3;
+        // the lines along the axis are independent
+        parallelRows(sizes[first], [&](int iStart, int iEnd) {
+            std::vector<float> line(n * 2);
+            for (int i = iStart; i < iEnd; i++)
+                for (int j = 0; j < sizes[second]; j++) {
+                    float * start = grid.data() + i * strides[first] + j * strides[second];
+                    for (int k = 0; k < n; k++)
+                        for (int c = 0; c < 2; c++)
+                            line[k * 2 + c] = start[k * stride + c];
+                    for (int k = 0; k < n; k++)
+                        for (int c = 0; c < 2; c++) {
+                            float sum = 0;
+                            for (int b = -2; b <= 2; b++)
+                                if (k + b >= 0 && k + b < n)
+                                    sum += binomial[b + 2] * line[(k + b) * 2 + c];
+                            start[k * stride + c] = sum;
+                        }
+                }
+        });
+    }
+
+    cv::Mat result(image.size(), CV_32FC1);
+    parallelRows(image.rows, [&](int rowStart, int rowEnd) {
+        for (int y = rowStart; y < rowEnd; y++) {
+            const float * in = image.ptr<float>(y);
+            float * out = result.ptr<float>(y);
+            for (int x = 0; x < image.cols; x++) {
+                int cells[3];
+                float fractions[3];
+                position(y, x, in[x], cells, fractions);
+                float sum = 0, normalization = 0;
+                for (int corner = 0; corner < 8; corner++) {
+                    float w = 1;
+                    for (int k = 0; k < 3; k++)
+                        w *= ((corner >> k) & 1) ? fractions[k] : 1 - fractions[k];
+                    const float * c = cell(cells[0] + (corner & 1), cells[1] + ((corner >> 1) & 1), cells[2] + ((corner >> 2) & 1));
+                    sum += w * c[0];
+                    normalization += w * c[1];
+                }
+                out[x] = sum / normalization;
+            }
+        }
+    });
+
+    return result;
+}
+
 /**
     Performs a bilateral filter with the given spatial smoothing kernel 
     and a intensity smoothing of scale sigma_r.
 
+    In exact mode, the interior of the image reads the neighbourhoods through row pointers.
+    For images holding 8 bit data (see quantizedLevels), the range weights of every pair of
+    levels are computed once in a table; other images call gaussian for every neighbour.
+    The grid mode computes an approximation whose cost does not depend on the size of the
+    kernel (see bilateralGrid); when the grid would be larger than the image (small kernel or
+    small sigma_r), a warning is printed and the exact mode is used instead. sigma_r must be
+    positive.
 */
-cv::Mat bilateralFilter(cv::Mat image, cv::Mat kernel, float sigma_r)
+cv::Mat bilateralFilter(cv::Mat image, cv::Mat kernel, float sigma_r, BilateralMode mode)
 {
+    CV_Assert(sigma_r > 0);
+    if (mode == BILATERAL_GRID) {
+        cv::Mat approximation = bilateralGrid(image, kernel, sigma_r);
+        if (!approximation.empty())
+            return approximation;
+        std::cerr << "!!!  Warning, bilateral grid larger than the image, using the exact filter." << std::endl;
+    }
+
     cv::Mat result = cv::Mat::zeros(image.size(), image.type());
 
     int kernelRadiusX = kernel.cols / 2;
     int kernelRadiusY = kernel.rows / 2;
+    NeighbourhoodExtent extent(kernelRadiusY, kernel.rows - 1 - kernelRadiusY, kernelRadiusX, kernel.cols - 1 - kernelRadiusX);
 
-    for (int y = 0; y < image.rows; y++) {
-        for (int x = 0; x < image.cols; x++) {
+    // rangeWeights[a * 256 + b]: range weight of a neighbour of level b around a pixel of level a
+    Mat levels;
+    bool quantized = quantizedLevels(image, levels);
+    std::vector<float> rangeWeights;
+    if (quantized) {
+        Mat values = levelValues();
+        const float * value = values.ptr<float>(0);
+        rangeWeights.resize(256 * 256);
+        for (int a = 0; a < 256; a++)
+            for (int b = 0; b < 256; b++)
+                rangeWeights[a * 256 + b] = gaussian(value[a] - value[b], sigma_r * sigma_r);
+    }
+
+    auto border = [&](int y, int x) {
+        float sum = 0.0;
+        float normalization = 0.0;
+
+        for (int ky = -kernelRadiusY; ky < kernel.rows - kernelRadiusY; ky++) {
+            for (int kx = -kernelRadiusX; kx < kernel.cols - kernelRadiusX; kx++) {
+                int srcX = x + kx;
+                int srcY = y + ky;
+
+                if (srcX >= 0 && srcX < image.cols && srcY >= 0 && srcY < image.rows) {
+                    float rangeWeight;
+                    if (quantized)
+                        rangeWeight = rangeWeights[levels.at<uchar>(y, x) * 256 + levels.at<uchar>(srcY, srcX)];
+                    else
+                        rangeWeight = gaussian(image.at<float>(y, x) - image.at<float>(srcY, srcX), sigma_r * sigma_r);
+                    float weight = rangeWeight * kernel.at<float>(ky + kernelRadiusY, kx + kernelRadiusX);
+                    sum += image.at<float>(srcY, srcX) * weight;
+                    normalization += weight;
+                }
+            }
+        }
+
+        result.at<float>(y, x) = sum / normalization;
+    };
+
+    auto interiorRow = [&](int y, int xStart, int xEnd) -> int {
+        const float * center = image.ptr<float>(y);
+        float * out = result.ptr<float>(y);
+        for (int x = xStart; x < xEnd; x++) {
             float sum = 0.0;
             float normalization = 0.0;
 
-            for (int ky = -kernelRadiusY; ky <= kernelRadiusY; ky++) {
-                for (int kx = -kernelRadiusX; kx <= kernelRadiusX; kx++) {
-                    int srcX = x + kx;
-                    int srcY = y + ky;
+            const float * centerWeights = quantized ? rangeWeights.data() + levels.at<uchar>(y, x) * 256 : NULL;
 
-                    if (srcX >= 0 && srcX < image.cols && srcY >= 0 && srcY < image.rows) {
-                        float diffIntensity = image.at<float>(y, x) - image.at<float>(srcY, srcX);
-                        float weight = gaussian(diffIntensity, sigma_r * sigma_r) * kernel.at<float>(ky + kernelRadiusY, kx + kernelRadiusX);
-                        sum += image.at<float>(srcY, srcX) * weight;
+            for (int ky = 0; ky < kernel.rows; ky++) {
+                const float * in = image.ptr<float>(y + ky - kernelRadiusY) + x - kernelRadiusX;
+                const float * spatial = kernel.ptr<float>(ky);
+                if (quantized) {
+                    const uchar * inLevels = levels.ptr<uchar>(y + ky - kernelRadiusY) + x - kernelRadiusX;
+                    for (int kx = 0; kx < kernel.cols; kx++) {
+                        float weight = centerWeights[inLevels[kx]] * spatial[kx];
+                        sum += in[kx] * weight;
+                        normalization += weight;
+                    }
+                } else {
+                    for (int kx = 0; kx < kernel.cols; kx++) {
+                        float diffIntensity = center[x] - in[kx];
+                        float weight = gaussian(diffIntensity, sigma_r * sigma_r) * spatial[kx];
+                        sum += in[kx] * weight;
                         normalization += weight;
                     }
                 }
             }
 
-            result.at<float>(y, x) = sum / normalization;
+            out[x] = sum / normalization;
         }
-    }
+        return xEnd;
+    };
+
+    parallelRows(image.rows, [&](int rowStart, int rowEnd) {
+        forEachPixelSplit(image.size(), extent, rowStart, rowEnd, border, interiorRow);
+    });
 
     return result;
-}
\ No newline at end of file
+}
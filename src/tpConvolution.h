@@ -5,8 +5,51 @@
 
 cv::Mat meanFilter(cv::Mat image, int size);
 
-cv::Mat convolution(cv::Mat image, cv::Mat kernel);
+/**
+    Algorithms available to compute a convolution (see convolution).
+*/
+enum ConvolutionBackend {
+    CONVOLUTION_AUTO,       // choose the cheapest backend with a cost model
+    CONVOLUTION_DIRECT,     // apply every kernel coefficient to every pixel
+    CONVOLUTION_SEPARABLE,  // sum of horizontal and vertical 1D passes
+    CONVOLUTION_FFT         // product of Fourier transforms
+};
+
+cv::Mat convolution(cv::Mat image, cv::Mat kernel, ConvolutionBackend backend=CONVOLUTION_AUTO);
+
+/**
+    Convolutions of a fixed image by several kernels computed with Fourier transforms.
+
+    The Fourier transform of the zero padded image is computed once and reused by
+    every following call to apply, as long as the padding is large enough for the kernel.
+    convolution(image, kernel, CONVOLUTION_FFT) builds a new FFTConvolution on each call
+    and so transforms the image every time: to filter one image by several kernels, keep
+    an FFTConvolution of it and call apply for each kernel, which only transforms the
+    kernel, multiplies and transforms back.
+
+    eg. FFTConvolution fft(image); Mat a = fft.apply(kernelA); Mat b = fft.apply(kernelB);
+*/
+class FFTConvolution
+{
+public:
+    FFTConvolution(cv::Mat image);
+
+    cv::Mat apply(cv::Mat kernel);
+
+private:
+    cv::Mat image;
+    cv::Mat spectrum;
+};
 
 cv::Mat edgeSobel(cv::Mat image);
 
-cv::Mat bilateralFilter(cv::Mat image, cv::Mat kernel, float sigma_r);
\ No newline at end of file
+/**
+    Algorithms available to compute a bilateral filter (see bilateralFilter).
+*/
+enum BilateralMode {
+    BILATERAL_EXACT,    // weight every neighbour of the spatial kernel
+    BILATERAL_GRID      // bilateral grid approximation, cost independent of the kernel size;
+                        // exact filter, with a warning, when the grid is larger than the image
+};
+
+cv::Mat bilateralFilter(cv::Mat image, cv::Mat kernel, float sigma_r, BilateralMode mode=BILATERAL_EXACT);
\ No newline at end of file
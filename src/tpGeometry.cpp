@@ -2,6 +2,7 @@
 #include <cmath>
 #include <algorithm>
 #include <tuple>
+#include "common.h"
 using namespace cv;
 using namespace std;
 
@@ -17,17 +18,20 @@ Mat transpose(Mat image)
     *********************************************/
     Mat res(image.cols, image.rows, CV_32FC1);
 
-    int y = 0;
-    while (y < image.rows)
-    {
-        int x =0;
-        while (x < image.cols)
+    // bands of output rows, i.e. of input columns
+    parallelRows(image.cols, [&](int xStart, int xEnd) {
+        int y = 0;
+        while (y < image.rows)
         {
-            res.at<float>(x, y) = image.at<float>(y, x);
-            x++;
+            int x = xStart;
+            while (x < xEnd)
+            {
+                res.at<float>(x, y) = image.at<float>(y, x);
+                x++;
+            }
+            y++;
         }
-        y++;
-    }
+    });
     /********************************************
                 END OF YOUR CODE
     *********************************************/
@@ -92,19 +96,21 @@ Mat expand(Mat image, int factor, float(* interpolationFunction)(cv::Mat image,
     int nouvelleHauteur = (image.rows - 1) * factor;
     int nouvelleLargeur = (image.cols - 1) * factor;
 
-    int y = 0;
-    while (y < nouvelleHauteur)
-    {
-        int x = 0;
-        while (x < nouvelleLargeur)
+    parallelRows(nouvelleHauteur, [&](int rowStart, int rowEnd) {
+        int y = rowStart;
+        while (y < rowEnd)
         {
-            float originalX = (float)(x) / factor;
-            float originalY = (float)(y) / factor;
-            res.at<float>(y, x) = interpolationFunction(image, originalY, originalX);
-            x++;
+            int x = 0;
+            while (x < nouvelleLargeur)
+            {
+                float originalX = (float)(x) / factor;
+                float originalY = (float)(y) / factor;
+                res.at<float>(y, x) = interpolationFunction(image, originalY, originalX);
+                x++;
+            }
+            y++;
         }
-        y++;
-    }
+    });
     /********************************************
                 END OF YOUR CODE
     *********************************************/
@@ -175,27 +181,30 @@ Mat rotate(Mat image, float angle, float(*interpolationFunction)(cv::Mat image,
 
     Mat res = Mat::zeros(nouvelleHauteur, nouvelleLargeur, CV_32FC1);
 
-    int k = 0;
-    while (k < nouvelleLargeur)
-    {
-        int m = 0;
-        while (m < nouvelleHauteur)
+    // every output pixel is computed independently: bands of output rows
+    parallelRows(nouvelleHauteur, [&](int rowStart, int rowEnd) {
+        int m = rowStart;
+        while (m < rowEnd)
         {
-            float x = k - ((nouvelleLargeur - 1) / 2.0);
-            float y = m - ((nouvelleHauteur - 1) / 2.0);
-            float sup = x * cos(-radius) - y * sin(-radius) + xOrigine;
-            float inf = x * sin(-radius) + y * cos(-radius) + yOrigine;
-
-            if (sup >= 0 && sup < image.cols - 1 && inf >= 0 && inf < image.rows - 1)
+            int k = 0;
+            while (k < nouvelleLargeur)
             {
-                res.at<float>(m, k) = interpolationFunction(image, inf, sup);
-            } else {
-                res.at<float>(m, k) = 0;
+                float x = k - ((nouvelleLargeur - 1) / 2.0);
+                float y = m - ((nouvelleHauteur - 1) / 2.0);
+                float sup = x * cos(-radius) - y * sin(-radius) + xOrigine;
+                float inf = x * sin(-radius) + y * cos(-radius) + yOrigine;
+
+                if (sup >= 0 && sup < image.cols - 1 && inf >= 0 && inf < image.rows - 1)
+                {
+                    res.at<float>(m, k) = interpolationFunction(image, inf, sup);
+                } else {
+                    res.at<float>(m, k) = 0;
+                }
+                k++;
             }
             m++;
         }
-        k++;
-    }
+    });
     /********************************************
                 END OF YOUR CODE
     *********************************************/
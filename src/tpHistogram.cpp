@@ -2,30 +2,221 @@
 #include <cmath>
 #include <algorithm>
 #include <tuple>
+#include <mutex>
+#include "common.h"
+#include "histogram.h"
+#include "simd.h"
 using namespace cv;
 using namespace std;
 
 /**
-    Inverse a grayscale image with float values.
-    for all pixel p: res(p) = 1.0 - image(p)
+    Point operators, res(p) = f(image(p)), are applied in place to rows of floats by
+    RowOperator functions: by vectors of VFLOAT_WIDTH values through vf when a vector form
+    is given, which must round exactly like f.
 */
-Mat inverse(Mat image)
+template<typename PixelFunction>
+static RowOperator rowOperator(PixelFunction f)
 {
-    // Clone original image
-    Mat res = image.clone();
-    
-    // Loop through each pixel and invert the value
-    for (int y = 0; y < image.rows; y++)
-    {
-        for (int x = 0; x < image.cols; x++)
-        {
-            float pixelValue = image.at<float>(y, x);
-            res.at<float>(y, x) = 1.0 - pixelValue;
+    return [=](float * row, int cols) {
+        for (int x = 0; x < cols; x++)
+            row[x] = f(row[x]);
+    };
+}
+
+template<typename PixelFunction, typename VectorFunction>
+static RowOperator rowOperator(PixelFunction f, VectorFunction vf)
+{
+    return [=](float * row, int cols) {
+        int x = 0;
+        for (; x + VFLOAT_WIDTH <= cols; x += VFLOAT_WIDTH)
+            vstore(row + x, vf(vload(row + x)));
+        for (; x < cols; x++)
+            row[x] = f(row[x]);
+    };
+}
+
+static RowOperator inverseRow()
+{
+    return rowOperator(
+        [](float v) { return 1.0f - v; },
+        [](vfloat v) { return vsub(vset(1.0f), v); });
+}
+
+// without branches: the value, replaced by 1 above highT, then by 0 below lowT
+static RowOperator thresholdRow(float lowT, float highT)
+{
+    return rowOperator(
+        [=](float v) { return (v <= lowT) ? 0.0f : (v <= highT) ? v : 1.0f; },
+        [=](vfloat v) { return vselect(vle(v, vset(lowT)), vset(0.0f), vselect(vle(v, vset(highT)), v, vset(1.0f))); });
+}
+
+// without branches: level floor(v * n) / (n - 1) below 1, NaN and the values from 1 on unchanged
+static RowOperator quantizeRow(int numberOfLevels)
+{
+    float n = numberOfLevels;
+    float last = std::max(numberOfLevels - 1, 1);
+    return rowOperator(
+        [=](float v) { float t = v * n; return (t < n) ? std::floor(std::max(t, 0.0f)) / last : v; },
+        [=](vfloat v) {
+            vfloat t = vmul(v, vset(n));
+            return vselect(vlt(t, vset(n)), vdiv(vfloor(vmax(t, vset(0.0f))), vset(last)), v);
+        });
+}
+
+// maps [minVal, maxVal] to [minValue, maxValue], in float so that it vectorizes
+static RowOperator normalizeRow(double minVal, double maxVal, float minValue, float maxValue)
+{
+    float low = minVal;
+    float scale = (maxValue - minValue) / (maxVal - minVal);
+    return rowOperator(
+        [=](float v) { return (v - low) * scale + minValue; },
+        [=](vfloat v) { return vadd(vmul(vsub(v, vset(low)), vset(scale)), vset(minValue)); });
+}
+
+PointPipeline::PointPipeline(Mat image) : image(image)
+{
+    assert(image.type() == CV_32FC1 || image.type() == CV_8UC1);
+}
+
+PointPipeline & PointPipeline::inverse()
+{
+    stages.push_back(Stage(inverseRow()));
+    return *this;
+}
+
+PointPipeline & PointPipeline::threshold(float lowT, float highT)
+{
+    assert(lowT <= highT);
+    stages.push_back(Stage(thresholdRow(lowT, highT)));
+    return *this;
+}
+
+PointPipeline & PointPipeline::quantize(int numberOfLevels)
+{
+    assert(numberOfLevels > 0);
+    stages.push_back(Stage(quantizeRow(numberOfLevels)));
+    return *this;
+}
+
+PointPipeline & PointPipeline::normalize(float minValue, float maxValue)
+{
+    assert(minValue <= maxValue);
+    Stage stage((RowOperator()));
+    stage.normalize = true;
+    stage.minValue = minValue;
+    stage.maxValue = maxValue;
+    stages.push_back(stage);
+    return *this;
+}
+
+/**
+    Smallest and largest values of image after the operators: the 256 values of an
+    unsigned char image go through them once and only those present in the image count,
+    the rows of a float image go through them one by one in a buffer.
+*/
+static void valueRange(Mat image, const vector<RowOperator> & operators, double & minVal, double & maxVal)
+{
+    float low = INFINITY, high = -INFINITY;
+    if (image.type() == CV_8UC1) {
+        vector<int> hist = histogram256(image);
+        float values[256];
+        for (int i = 0; i < 256; i++)
+            values[i] = (float)(i / 255.0);
+        for (const RowOperator & op : operators)
+            op(values, 256);
+        for (int i = 0; i < 256; i++)
+            if (hist[i] != 0) {
+                low = std::min(low, values[i]);
+                high = std::max(high, values[i]);
+            }
+    } else {
+        std::mutex merge;
+        parallelRows(image.rows, [&](int rowStart, int rowEnd) {
+            vector<float> row(image.cols);
+            float bandLow = INFINITY, bandHigh = -INFINITY;
+            for (int y = rowStart; y < rowEnd; y++) {
+                const float * in = image.ptr<float>(y);
+                std::copy(in, in + image.cols, row.begin());
+                for (const RowOperator & op : operators)
+                    op(row.data(), image.cols);
+                for (int x = 0; x < image.cols; x++) {
+                    bandLow = std::min(bandLow, row[x]);
+                    bandHigh = std::max(bandHigh, row[x]);
+                }
+            }
+            std::lock_guard<std::mutex> lock(merge);
+            low = std::min(low, bandLow);
+            high = std::max(high, bandHigh);
+        });
+    }
+    minVal = low;
+    maxVal = high;
+}
+
+/**
+    A normalization stage gets the range of the values produced by the stages before it
+    (see valueRange), then all the stages are applied in one pass:
+     - an unsigned char image goes through a table of the 256 results, computed in float
+       and rounded once at the end
+     - each row of a float image is copied to the result, where the stages are applied in
+       place while it is in cache.
+*/
+Mat PointPipeline::apply() const
+{
+    vector<RowOperator> operators;
+    for (const Stage & stage : stages) {
+        if (!stage.normalize) {
+            operators.push_back(stage.op);
+            continue;
         }
+        double minVal, maxVal;
+        valueRange(image, operators, minVal, maxVal);
+        operators.push_back(normalizeRow(minVal, maxVal, stage.minValue, stage.maxValue));
     }
+
+    Mat res(image.size(), image.type());
+    if (image.type() == CV_8UC1) {
+        float values[256];
+        for (int i = 0; i < 256; i++)
+            values[i] = (float)(i / 255.0);
+        for (const RowOperator & op : operators)
+            op(values, 256);
+        uchar table[256];
+        for (int i = 0; i < 256; i++)
+            table[i] = saturate_cast<uchar>(values[i] * 255);
+
+        parallelRows(image.rows, [&](int rowStart, int rowEnd) {
+            for (int y = rowStart; y < rowEnd; y++) {
+                const uchar * in = image.ptr<uchar>(y);
+                uchar * out = res.ptr<uchar>(y);
+                for (int x = 0; x < image.cols; x++)
+                    out[x] = table[in[x]];
+            }
+        });
+        return res;
+    }
+
+    parallelRows(image.rows, [&](int rowStart, int rowEnd) {
+        for (int y = rowStart; y < rowEnd; y++) {
+            const float * in = image.ptr<float>(y);
+            float * out = res.ptr<float>(y);
+            std::copy(in, in + image.cols, out);
+            for (const RowOperator & op : operators)
+                op(out, image.cols);
+        }
+    });
     return res;
 }
 
+/**
+    Inverse a grayscale image with float values.
+    for all pixel p: res(p) = 1.0 - image(p)
+*/
+Mat inverse(Mat image)
+{
+    return PointPipeline(image).inverse().apply();
+}
+
 /**
     Thresholds a grayscale image with float values.
     for all pixel p: res(p) =
@@ -35,32 +226,7 @@ Mat inverse(Mat image)
 */
 Mat threshold(Mat image, float lowT, float highT)
 {
-    // Clone of the input image to store the result
-    Mat res = image.clone();
-
-    // Ensure that lowT is less than or equal to highT
-    assert(lowT <= highT);
-
-    // Iterate through each pixel of the image
-    for (int i = 0; i < image.rows; i++) {
-        for (int j = 0; j < image.cols; j++) {
-            // Get the value of the pixel at position (i, j)
-            float pixelValue = image.at<float>(i, j);
-
-            // Compare the pixel value with the thresholds
-            if (pixelValue <= lowT) {
-                res.at<float>(i, j) = 0.0;
-            }
-            else if (lowT < pixelValue && pixelValue <= highT) {
-                res.at<float>(i, j) = pixelValue;
-            }
-            else {
-                res.at<float>(i, j) = 1.0;
-            }
-        }
-    }
-
-    return res;
+    return PointPipeline(image).threshold(lowT, highT).apply();
 }
 
 /**
@@ -79,48 +245,84 @@ Mat threshold(Mat image, float lowT, float highT)
 
         and so on for other values of numberOfLevels.
 
+    The level of a pixel is k = floor(image(p) * numberOfLevels), computed in float, giving
+    res(p) = k / (numberOfLevels - 1); a pixel with k >= numberOfLevels (image(p) >= 1) is left
+    unchanged, one with k < 0 gets level 0.
 */
 Mat quantize(Mat image, int numberOfLevels)
 {
-    Mat res = image.clone();
-    assert(numberOfLevels > 0);
+    return PointPipeline(image).quantize(numberOfLevels).apply();
+}
 
-    // Loop through each pixel in the image
-    for (int i = 0; i < res.rows; i++) {
-        for (int j = 0; j < res.cols; j++) {
-            for(int k = 0; k < numberOfLevels; k++) {
+/**
+    Normalize a grayscale image with float values
+    Target range is [minValue, maxValue].
+*/
+Mat normalize(Mat image, float minValue, float maxValue)
+{
+    return PointPipeline(image).normalize(minValue, maxValue).apply();
+}
 
-                if (res.at<float>(i, j) < (1.0 / numberOfLevels) * (k + 1)) {
-                    res.at<float>(i, j) = (1.0 / (numberOfLevels - 1)) * k;
-                    break;
-                }
+/**
+    Histogram equalization of a float image (CV_32FC1) of values in [0, 1] with a histogram of
+    bins bins (see histogramFloat): a pixel takes the fraction of the pixels in the bins below
+    its own, plus the fraction in its bin linearly interpolated at its position in the bin, so
+    the pixels of a bin keep their order. NaN pixels are counted in the first bin and stay NaN.
+*/
+static Mat equalizeFloat(Mat image, int bins)
+{
+    Mat res(image.size(), CV_32FC1);
+    std::vector<int> hist = histogramFloat(image, bins);
+
+    // number of pixels in the bins below each bin, in double: exact beyond the 2^24
+    // pixels where float counts start rounding
+    std::vector<double> below(bins, 0);
+    for (int b = 1; b < bins; b++)
+        below[b] = below[b - 1] + hist[b - 1];
+
+    double total = image.total();
+    float scale = bins;
+    parallelRows(image.rows, [&](int rowStart, int rowEnd) {
+        for (int y = rowStart; y < rowEnd; y++) {
+            const float * in = image.ptr<float>(y);
+            float * out = res.ptr<float>(y);
+            for (int x = 0; x < image.cols; x++) {
+                int b = floatBin(in[x], bins, 0, scale);
+                float position = std::min(std::max(in[x] * scale - b, 0.0f), 1.0f);
+                out[x] = (float)((below[b] + position * (double)hist[b]) / total);
             }
         }
-    }
+    });
 
     return res;
 }
 
 /**
-    Normalize a grayscale image with float values
-    Target range is [minValue, maxValue].
+    Histogram equalization of an unsigned short image (CV_16UC1, values in [0;65535]) with one
+    bin per value (see histogram65536), rounded like the unsigned char equalization.
 */
-Mat normalize(Mat image, float minValue, float maxValue)
+static Mat equalize16(Mat image)
 {
-    Mat res = image.clone();
-    assert(minValue <= maxValue);
-
-    // Find the minimum and maximum values in the image
-    double minVal, maxVal;
-    minMaxLoc(res, &minVal, &maxVal);
+    Mat res(image.size(), CV_16UC1);
+    std::vector<int> hist = histogram65536(image);
+
+    // the cumulative counts in double stay exact beyond 2^31 pixels
+    std::vector<ushort> table(65536);
+    double total = image.total();
+    double cumHist = 0;
+    for (int i = 0; i < 65536; i++) {
+        cumHist += hist[i];
+        table[i] = saturate_cast<ushort>(cumHist / total * 65535.0);
+    }
 
-    // Find the minimum and maximum values in the image
-    for (int i = 0; i < res.rows; i++) {
-        for (int j = 0; j < res.cols; j++) {
-            // Normalize the pixel value within the range [minValue, maxValue]
-            res.at<float>(i, j) = ((res.at<float>(i, j) - minVal) / (maxVal - minVal)) * (maxValue - minValue) + minValue;
+    parallelRows(image.rows, [&](int rowStart, int rowEnd) {
+        for (int y = rowStart; y < rowEnd; y++) {
+            const ushort * in = image.ptr<ushort>(y);
+            ushort * out = res.ptr<ushort>(y);
+            for (int x = 0; x < image.cols; x++)
+                out[x] = table[in[x]];
         }
-    }
+    });
 
     return res;
 }
@@ -130,41 +332,165 @@ Mat normalize(Mat image, float minValue, float maxValue)
 
     Warning: this time, image values are unsigned chars but calculation will be done in float or double format.
     The final result must be rounded toward the nearest integer 
+
+    Float images (CV_32FC1, values in [0;1]) are equalized with a histogram of bins > 0 bins
+    (see equalizeFloat), and unsigned short images (CV_16UC1) with one bin per value (see
+    equalize16).
 */
-Mat equalize(Mat image)
+Mat equalize(Mat image, int bins)
 {
+    CV_Assert((image.type() == CV_8UC1 || image.type() == CV_16UC1 || image.type() == CV_32FC1) && bins > 0);
+    if (image.type() == CV_32FC1)
+        return equalizeFloat(image, bins);
+    if (image.type() == CV_16UC1)
+        return equalize16(image);
+
     Mat res = image.clone();
     
-    // Initialize a histogram and cumulative histogram
-    std::vector<int> hist(256, 0);
+    // Calculate the histogram of the input image and initialize the cumulative histogram
+    std::vector<int> hist = histogram256(image);
     std::vector<int> cumHist(256, 0);
     int totalPixels = image.rows * image.cols;
 
-    // Calculate the histogram of the input image
-    for (int i = 0; i < image.rows; i++) {
-        for (int j = 0; j < image.cols; j++) {
-            uchar pixelValue = image.at<uchar>(i, j);
-            hist[pixelValue]++;
-        }
-    }
-
     // Calculate the cumulative histogram
     cumHist[0] = hist[0];
     for (int i = 1; i < 256; i++) {
         cumHist[i] = cumHist[i - 1] + hist[i];
     }
 
+    // New value of each gray level, rounded
+    uchar table[256];
+    for (int i = 0; i < 256; i++) {
+        float normalizedValue = static_cast<float>(cumHist[i]) / totalPixels * 255.0f;
+        table[i] = cvRound(normalizedValue);
+    }
+
     // Apply histogram equalization to the input image
-    for (int i = 0; i < image.rows; i++) {
-        for (int j = 0; j < image.cols; j++) {
-            uchar pixelValue = image.at<uchar>(i, j);
-            float normalizedValue = static_cast<float>(cumHist[pixelValue]) / totalPixels * 255.0f;
+    parallelRows(image.rows, [&](int rowStart, int rowEnd) {
+        for (int i = rowStart; i < rowEnd; i++) {
+            const uchar * in = image.ptr<uchar>(i);
+            uchar * out = res.ptr<uchar>(i);
+            for (int j = 0; j < image.cols; j++)
+                out[j] = table[in[j]];
+        }
+    });
 
-            // Round and set the normalized value as the result pixel value
-            res.at<uchar>(i, j) = cvRound(normalizedValue);
+    return res;
+}
+
+/**
+    Contrast limited adaptive histogram equalization (CLAHE) of an unsigned char image ([0;255]).
+
+    The image is cut in tiles x tiles tiles, each one equalized with its own table as in equalize,
+    after clipping its histogram at clipLimit times the mean count of a bin: the clipped counts
+    are spread over all the bins, which limits the amplification of the noise in flat regions
+    (clipLimit <= 0 disables the clipping). Each pixel is then the bilinear interpolation of the
+    tables of the four tiles whose centers surround it, which avoids visible tile boundaries.
+
+    The tile histograms cost one pass over the image whatever the size of the tiles, and the
+    interpolation a constant time per pixel. When the image size is a multiple of the number of
+    tiles, the result is the one of cv::createCLAHE(clipLimit, Size(tiles, tiles)); otherwise the
+    last tiles are smaller instead of padded.
+*/
+Mat equalizeLocal(Mat image, int tiles, float clipLimit)
+{
+    CV_Assert(image.type() == CV_8UC1 && tiles > 0);
+    Mat res(image.rows, image.cols, CV_8UC1);
+    if (image.empty())
+        return res;
+
+    int tileWidth = (image.cols + tiles - 1) / tiles;
+    int tileHeight = (image.rows + tiles - 1) / tiles;
+    // a small image may need less tiles to leave none empty
+    int tilesX = (image.cols + tileWidth - 1) / tileWidth;
+    int tilesY = (image.rows + tileHeight - 1) / tileHeight;
+
+    // table of each tile, from its clipped histogram: each band of rows of tiles counts
+    // the histograms of its tiles in a single pass over its rows
+    std::vector<uchar> tables(tilesX * tilesY * 256);
+    parallelRows(tilesY, [&](int tileRowStart, int tileRowEnd) {
+        const int lanes = 4;
+        std::vector<int> counts(tilesX * lanes * 256);
+        for (int ty = tileRowStart; ty < tileRowEnd; ty++) {
+            std::fill(counts.begin(), counts.end(), 0);
+            int y0 = ty * tileHeight, y1 = std::min(y0 + tileHeight, image.rows);
+            for (int y = y0; y < y1; y++) {
+                const uchar * in = image.ptr<uchar>(y);
+                for (int tx = 0; tx < tilesX; tx++) {
+                    int x0 = tx * tileWidth;
+                    countLanes<uchar, lanes>(in + x0, std::min(tileWidth, image.cols - x0), 256,
+                                             [](uchar v) { return (int)v; }, &counts[tx * lanes * 256]);
+                }
+            }
+
+            for (int tx = 0; tx < tilesX; tx++) {
+                int * hist = &counts[tx * lanes * 256];
+                mergeLanes(hist, lanes, 256);
+                int tilePixels = std::min(tileWidth, image.cols - tx * tileWidth) * (y1 - y0);
+
+                if (clipLimit > 0) {
+                    int limit = std::max((int)(clipLimit * tilePixels / 256), 1);
+                    int clipped = 0;
+                    for (int i = 0; i < 256; i++) {
+                        if (hist[i] > limit) {
+                            clipped += hist[i] - limit;
+                            hist[i] = limit;
+                        }
+                    }
+                    // spread evenly, the remainder on bins spaced regularly
+                    int batch = clipped / 256;
+                    int residual = clipped - batch * 256;
+                    for (int i = 0; i < 256; i++)
+                        hist[i] += batch;
+                    if (residual != 0) {
+                        int step = std::max(256 / residual, 1);
+                        for (int i = 0; i < 256 && residual > 0; i += step, residual--)
+                            hist[i]++;
+                    }
+                }
+
+                uchar * table = &tables[(ty * tilesX + tx) * 256];
+                float scale = 255.0f / tilePixels;
+                int cumHist = 0;
+                for (int i = 0; i < 256; i++) {
+                    cumHist += hist[i];
+                    table[i] = saturate_cast<uchar>(cumHist * scale);
+                }
+            }
         }
+    });
+
+    // the two tiles surrounding each column, and the weight of the second one
+    std::vector<int> left(image.cols), right(image.cols);
+    std::vector<float> weightRight(image.cols);
+    for (int x = 0; x < image.cols; x++) {
+        float tx = x * (1.0f / tileWidth) - 0.5f;
+        int tx1 = cvFloor(tx);
+        weightRight[x] = tx - tx1;
+        left[x] = std::max(tx1, 0) * 256;
+        right[x] = std::min(tx1 + 1, tilesX - 1) * 256;
     }
 
+    parallelRows(image.rows, [&](int rowStart, int rowEnd) {
+        for (int y = rowStart; y < rowEnd; y++) {
+            float ty = y * (1.0f / tileHeight) - 0.5f;
+            int ty1 = cvFloor(ty);
+            float weightBottom = ty - ty1;
+            const uchar * top = &tables[std::max(ty1, 0) * tilesX * 256];
+            const uchar * bottom = &tables[std::min(ty1 + 1, tilesY - 1) * tilesX * 256];
+
+            const uchar * in = image.ptr<uchar>(y);
+            uchar * out = res.ptr<uchar>(y);
+            for (int x = 0; x < image.cols; x++) {
+                int v = in[x];
+                float wr = weightRight[x];
+                float topValue = top[left[x] + v] * (1 - wr) + top[right[x] + v] * wr;
+                float bottomValue = bottom[left[x] + v] * (1 - wr) + bottom[right[x] + v] * wr;
+                out[x] = saturate_cast<uchar>(topValue * (1 - weightBottom) + bottomValue * weightBottom);
+            }
+        }
+    });
+
     return res;
 }
 
@@ -175,27 +501,21 @@ Mat equalize(Mat image)
 Mat thresholdOtsu(Mat image) {
     Mat res = image.clone();
 
-    int hist[256] = {0}; // Initialize the histogram
-
     // Calculate the histogram
-    for (int y = 0; y < image.rows; y++) {
-        for (int x = 0; x < image.cols; x++) {
-            int intensity = image.at<uchar>(y, x);
-            hist[intensity]++;
-        }
-    }
+    std::vector<int> hist = histogram256(image);
 
-    int totalPixels = image.rows * image.cols;
-    float sum = 0.0;
+    // class weights and sums in double: exact for any realistic image size
+    double totalPixels = (double)image.rows * image.cols;
+    double sum = 0.0;
 
     for (int i = 0; i < 256; i++) {
-        sum += i * float((hist[i]));
+        sum += i * double(hist[i]);
     }
 
-    float sumLower = 0.0;
-    int weightLower = 0;
-    int weightUpper = 0;
-    float maxVar = 0.0;
+    double sumLower = 0.0;
+    double weightLower = 0;
+    double weightUpper = 0;
+    double maxVar = 0.0;
     int threshold = 0;
 
     for (int i = 0; i < 256; i++) {
@@ -205,12 +525,12 @@ Mat thresholdOtsu(Mat image) {
         weightUpper = totalPixels - weightLower;
         if (weightUpper == 0) break;
 
-        sumLower += i * float((hist[i]));
+        sumLower += i * double(hist[i]);
 
-        float meanPixelLower = sumLower / weightLower;
-        float meanPixelUpper = (sum - sumLower) / weightUpper;
+        double meanPixelLower = sumLower / weightLower;
+        double meanPixelUpper = (sum - sumLower) / weightUpper;
 
-        float varBetween = float((weightLower)) * float((weightUpper) * (meanPixelLower - meanPixelUpper) * (meanPixelLower - meanPixelUpper));
+        double varBetween = weightLower * weightUpper * (meanPixelLower - meanPixelUpper) * (meanPixelLower - meanPixelUpper);
         if (varBetween > maxVar) {
             maxVar = varBetween;
             threshold = i;
@@ -218,14 +538,65 @@ Mat thresholdOtsu(Mat image) {
     }
 
     // Binarize the image using the found threshold
-    for (int y = 0; y < image.rows; y++) {
-        for (int x = 0; x < image.cols; x++) {
-            if (image.at<uchar>(y, x) > threshold) {
-                res.at<uchar>(y, x) = 255; // White
-            } else {
-                res.at<uchar>(y, x) = 0;   // Black
+    parallelRows(image.rows, [&](int rowStart, int rowEnd) {
+        for (int y = rowStart; y < rowEnd; y++) {
+            const uchar * in = image.ptr<uchar>(y);
+            uchar * out = res.ptr<uchar>(y);
+            for (int x = 0; x < image.cols; x++)
+                out[x] = (in[x] > threshold) ? 255 : 0;    // white or black
+        }
+    });
+    return res;
+}
+
+/**
+    Binarization of the input float image with a threshold per pixel, computed from the mean m
+    and the standard deviation s of the values in the window of size 2k+1 centered on the pixel:
+     - THRESHOLD_NIBLACK: m + weight * s (weight is typically -0.2)
+     - THRESHOLD_SAUVOLA: m * (1 + weight * (s / 0.5 - 1)), 0.5 being the largest deviation
+       of values in [0, 1] (weight is typically between 0.2 and 0.5)
+    Pixels above their threshold are set to 1, the others to 0.
+
+    Windows crossing the image border are clipped to the image domain. The window sums of the
+    values and of their squares are read from summed-area tables (see integralImage), so the
+    cost per pixel does not depend on k. The tables accumulate in double precision, and the
+    variance is computed from the window sums in double, where the cancellation of
+    sum(v^2)/n - m^2 stays negligible even on large frames.
+*/
+Mat thresholdLocal(Mat image, int k, float weight, LocalThresholdMethod method)
+{
+    CV_Assert(image.type() == CV_32FC1 && k >= 0);
+    Mat res(image.size(), CV_32FC1);
+    Mat sat = integralImage(image);
+    Mat satSquared = integralImage(image, true);
+
+    parallelRows(image.rows, [&](int rowStart, int rowEnd) {
+        for (int y = rowStart; y < rowEnd; y++) {
+            // rows [rowMin, rowMax[ of the window, clipped to the image
+            int rowMin = std::max(y - k, 0);
+            int rowMax = std::min(y + k + 1, image.rows);
+            const double * top = sat.ptr<double>(rowMin);
+            const double * bottom = sat.ptr<double>(rowMax);
+            const double * topSquared = satSquared.ptr<double>(rowMin);
+            const double * bottomSquared = satSquared.ptr<double>(rowMax);
+            const float * in = image.ptr<float>(y);
+            float * out = res.ptr<float>(y);
+
+            for (int x = 0; x < image.cols; x++) {
+                int colMin = std::max(x - k, 0);
+                int colMax = std::min(x + k + 1, image.cols);
+                double n = (double)(rowMax - rowMin) * (colMax - colMin);
+                double sum = bottom[colMax] - bottom[colMin] - top[colMax] + top[colMin];
+                double sumSquared = bottomSquared[colMax] - bottomSquared[colMin] - topSquared[colMax] + topSquared[colMin];
+                double mean = sum / n;
+                double deviation = std::sqrt(std::max(sumSquared / n - mean * mean, 0.0));
+
+                double threshold = (method == THRESHOLD_NIBLACK) ? mean + weight * deviation
+                                                                 : mean * (1 + weight * (deviation / 0.5 - 1));
+                out[x] = (in[x] > threshold) ? 1.0f : 0.0f;
             }
         }
-    }
+    });
+
     return res;
 }
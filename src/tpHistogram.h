@@ -2,6 +2,8 @@
 #pragma once
 
 #include <opencv2/opencv.hpp>
+#include <vector>
+#include <functional>
 
 
 cv::Mat inverse(cv::Mat image);
@@ -12,7 +14,60 @@ cv::Mat normalize(cv::Mat image,  float minValue=0, float maxValue=1);
 
 cv::Mat quantize(cv::Mat image, int numberOfLevels);
 
-cv::Mat equalize(cv::Mat image);
+cv::Mat equalize(cv::Mat image, int bins=4096);
+
+cv::Mat equalizeLocal(cv::Mat image, int tiles=8, float clipLimit=2.0f);
 
 cv::Mat thresholdOtsu(cv::Mat image);
 
+/**
+    Local thresholds computed from the mean and standard deviation of a window (see thresholdLocal).
+*/
+enum LocalThresholdMethod {
+    THRESHOLD_NIBLACK,  // mean + weight * deviation
+    THRESHOLD_SAUVOLA   // mean * (1 + weight * (deviation / 0.5 - 1)), robust to the contrast variations
+};
+
+cv::Mat thresholdLocal(cv::Mat image, int k, float weight, LocalThresholdMethod method=THRESHOLD_SAUVOLA);
+
+// point operator applied in place to a row of cols floats
+typedef std::function<void(float * row, int cols)> RowOperator;
+
+/**
+    Chain of point operators on an image of type CV_32FC1 or CV_8UC1 (standing for the
+    values 0 to 1 in 255ths), evaluated lazily: the operations only record stages, and
+    apply() computes the result in a single pass over the image, without the intermediate
+    images. The result is the same as chaining inverse, threshold, quantize and normalize
+    on a float image; an unsigned char image is only rounded at the end.
+
+    eg. PointPipeline(image).normalize().quantize(8).threshold(0.2f, 0.8f).inverse().apply()
+
+    A normalization needs the range of the values before it, which costs one more pass.
+*/
+class PointPipeline
+{
+public:
+    explicit PointPipeline(cv::Mat image);
+
+    PointPipeline & inverse();
+    PointPipeline & threshold(float lowT, float highT);
+    PointPipeline & quantize(int numberOfLevels);
+    PointPipeline & normalize(float minValue=0, float maxValue=1);
+
+    cv::Mat apply() const;
+
+private:
+    struct Stage
+    {
+        RowOperator op;
+        // a normalization to [minValue, maxValue] has no operator until the range is known
+        bool normalize;
+        float minValue, maxValue;
+
+        Stage(RowOperator op) : op(op), normalize(false), minValue(0), maxValue(1) {}
+    };
+
+    cv::Mat image;
+    std::vector<Stage> stages;
+};
+
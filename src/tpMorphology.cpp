@@ -3,11 +3,331 @@
 #include <algorithm>
 #include <tuple>
 #include <limits>
+#include <memory>
 #include "common.h"
+#include "neighbourhood.h"
 using namespace cv;
 using namespace std;
 
 
+/**
+    Horizontal run of active elements of a structuring element: the offsets
+    (dy, dx), (dy, dx + 1) ... (dy, dx + length - 1).
+*/
+struct Chord
+{
+    int dy, dx, length;
+
+    Chord(int dy, int dx, int length) : dy(dy), dx(dx), length(length) {}
+};
+
+/**
+    Structuring element compiled once for erosion and dilation, centered at (radiusY, radiusX):
+     - offsets: the offsets (dx, dy), dy in [-radiusY, radiusY] and dx in [-radiusX, radiusX],
+       of its active (value 1) elements, in row-major order
+     - chords: the maximal horizontal runs of active elements
+     - box: the bounding box of the offsets, and rectangle is true if the offsets fill it
+       (rectangles, horizontal and vertical lines)
+*/
+struct CompiledStructuringElement
+{
+    vector<Point> offsets;
+    vector<Chord> chords;
+    Rect box;
+    bool rectangle;
+
+    CompiledStructuringElement(Mat structuringElement, int radiusY, int radiusX) : rectangle(false)
+    {
+        for (int dy = -radiusY; dy <= radiusY; dy++) {
+            int runStart = 0, runLength = 0;
+            for (int dx = -radiusX; dx <= radiusX; dx++) {
+                int row = dy + radiusY;
+                int col = dx + radiusX;
+                if (row < structuringElement.rows && col < structuringElement.cols
+                    && structuringElement.at<float>(row, col) == 1) {
+                    offsets.push_back(Point(dx, dy));
+                    if (runLength == 0)
+                        runStart = dx;
+                    runLength++;
+                } else if (runLength > 0) {
+                    chords.push_back(Chord(dy, runStart, runLength));
+                    runLength = 0;
+                }
+            }
+            if (runLength > 0)
+                chords.push_back(Chord(dy, runStart, runLength));
+        }
+
+        if (offsets.empty())
+            return;
+        int minX = offsets[0].x, maxX = offsets[0].x;
+        int minY = offsets[0].y, maxY = offsets[0].y;
+        for (const Point & offset : offsets) {
+            minX = std::min(minX, offset.x);
+            maxX = std::max(maxX, offset.x);
+            minY = std::min(minY, offset.y);
+            maxY = std::max(maxY, offset.y);
+        }
+        box = Rect(minX, minY, maxX - minX + 1, maxY - minY + 1);
+        // offsets are distinct: they fill the box iff there are as many as box pixels
+        rectangle = (int)offsets.size() == box.area();
+    }
+};
+
+/**
+    Index and fractional part of the position rank*(n-1) in a sorted list of n values.
+*/
+static void rankPosition(int n, float rank, int & index, float & fraction)
+{
+    float position = rank * (n - 1);
+    index = std::min((int)position, n - 1);
+    fraction = position - index;
+}
+
+/**
+    Linear interpolation between the values a and b of two consecutive positions.
+*/
+static inline float interpolateRank(float a, float b, float fraction)
+{
+    return (fraction == 0) ? a : (1 - fraction) * a + fraction * b;
+}
+
+/**
+    Rank filter of an image of 8 bit levels (see quantizedLevels) with the algorithm of
+    Perreault and Hebert: each column keeps the histogram of the 2*size+1 levels of the
+    window rows, and the window histogram is the sum of the 2*size+1 column histograms.
+    Both are updated by adding the entering and removing the leaving row or column, so the
+    cost per pixel does not depend on size.
+
+    The 256 bins are grouped in 16 coarse bins of 16 levels: the window histogram of the
+    coarse bins is maintained for every pixel, while the fine bins of a coarse bin are only
+    brought up to date when the searched rank falls in that coarse bin.
+
+    Only the rows [rowStart, rowEnd[ of res are computed: the column histograms are filled
+    with the window of the first row, so bands of rows can be filtered independently.
+*/
+static void histogramRankFilter(Mat levels, Mat values, int size, float rank, Mat res, int rowStart, int rowEnd)
+{
+    const int BINS = 256;
+    const int COARSE_BINS = 16;
+    const int FINE_BINS = BINS / COARSE_BINS;
+
+    int rows = levels.rows;
+    int cols = levels.cols;
+    const float * value = values.ptr<float>(0);
+
+    std::vector<int> columnFine(cols * BINS, 0);
+    std::vector<int> columnCoarse(cols * COARSE_BINS, 0);
+
+    auto updateColumns = [&](int y, int delta) {
+        const uchar * in = levels.ptr<uchar>(y);
+        for (int x = 0; x < cols; x++) {
+            columnFine[x * BINS + in[x]] += delta;
+            columnCoarse[x * COARSE_BINS + in[x] / FINE_BINS] += delta;
+        }
+    };
+
+    int windowFine[BINS];
+    int windowCoarse[COARSE_BINS];
+    // columns [fineFirst[c], fineLast[c]] summed in the fine bins of coarse bin c
+    int fineFirst[COARSE_BINS];
+    int fineLast[COARSE_BINS];
+
+    auto updateWindow = [&](int x, int delta) {
+        const int * column = columnCoarse.data() + x * COARSE_BINS;
+        for (int c = 0; c < COARSE_BINS; c++)
+            windowCoarse[c] += delta * column[c];
+    };
+
+    auto updateFine = [&](int c, int x, int delta) {
+        const int * column = columnFine.data() + x * BINS + c * FINE_BINS;
+        int * window = windowFine + c * FINE_BINS;
+        for (int b = 0; b < FINE_BINS; b++)
+            window[b] += delta * column[b];
+    };
+
+    // level of the k-th (from 0) smallest value of the window made of columns [first, last]
+    auto select = [&](int k, int first, int last) -> int {
+        int c = 0;
+        while (k >= windowCoarse[c])
+            k -= windowCoarse[c++];
+
+        int incrementalCost = (first - fineFirst[c]) + (last - fineLast[c]);
+        if (fineFirst[c] > fineLast[c] || fineLast[c] < first || incrementalCost > last - first + 1) {
+            std::fill(windowFine + c * FINE_BINS, windowFine + (c + 1) * FINE_BINS, 0);
+            for (int x = first; x <= last; x++)
+                updateFine(c, x, 1);
+        } else {
+            for (int x = fineFirst[c]; x < first; x++)
+                updateFine(c, x, -1);
+            for (int x = fineLast[c] + 1; x <= last; x++)
+                updateFine(c, x, 1);
+        }
+        fineFirst[c] = first;
+        fineLast[c] = last;
+
+        const int * fine = windowFine + c * FINE_BINS;
+        int b = 0;
+        while (k >= fine[b])
+            k -= fine[b++];
+        return c * FINE_BINS + b;
+    };
+
+    for (int y = std::max(rowStart - size, 0); y <= std::min(rowStart + size, rows - 1); y++)
+        updateColumns(y, 1);
+
+    for (int y = rowStart; y < rowEnd; y++) {
+        if (y > rowStart) {
+            if (y - size - 1 >= 0)
+                updateColumns(y - size - 1, -1);
+            if (y + size < rows)
+                updateColumns(y + size, 1);
+        }
+        int windowRows = std::min(y + size, rows - 1) - std::max(y - size, 0) + 1;
+
+        std::fill(windowCoarse, windowCoarse + COARSE_BINS, 0);
+        for (int c = 0; c < COARSE_BINS; c++) {
+            fineFirst[c] = 0;
+            fineLast[c] = -1;
+        }
+        for (int x = 0; x <= std::min(size, cols - 1); x++)
+            updateWindow(x, 1);
+
+        float * out = res.ptr<float>(y);
+        for (int x = 0; x < cols; x++) {
+            if (x > 0) {
+                if (x - size - 1 >= 0)
+                    updateWindow(x - size - 1, -1);
+                if (x + size < cols)
+                    updateWindow(x + size, 1);
+            }
+            int first = std::max(x - size, 0);
+            int last = std::min(x + size, cols - 1);
+
+            int index;
+            float fraction;
+            rankPosition(windowRows * (last - first + 1), rank, index, fraction);
+            float a = value[select(index, first, last)];
+            float b = (fraction == 0) ? a : value[select(index + 1, first, last)];
+            out[x] = interpolateRank(a, b, fraction);
+        }
+    }
+}
+
+// largest window sorted by the vectorized sorting network in sortingRankFilter
+static const int SORTING_NETWORK_MAX_SIZE = 25;
+
+/**
+    Exact rank filter of any float image: the values of each window are gathered and
+    partially sorted. In the interior of the image, small windows of VFLOAT_WIDTH
+    consecutive pixels are sorted together by an odd-even transposition network.
+    Only the rows [rowStart, rowEnd[ of res are computed.
+*/
+static void sortingRankFilter(Mat image, int size, float rank, Mat res, int rowStart, int rowEnd)
+{
+    int windowSide = 2 * size + 1;
+    int n = windowSide * windowSide;
+    std::vector<float> pixVoisin;
+    pixVoisin.reserve(n);
+
+    auto border = [&](int i, int j) {
+        pixVoisin.clear();
+        int minLigne = std::max(i - size, 0);
+        int maxLigne = std::min(i + size, image.rows - 1);
+        int minColonne = std::max(j - size, 0);
+        int maxColonne = std::min(j + size, image.cols - 1);
+
+        for (int x = minLigne; x <= maxLigne; x++)
+            for (int y = minColonne; y <= maxColonne; y++)
+                pixVoisin.push_back(image.at<float>(x, y));
+
+        int index;
+        float fraction;
+        rankPosition(pixVoisin.size(), rank, index, fraction);
+        std::nth_element(pixVoisin.begin(), pixVoisin.begin() + index, pixVoisin.end());
+        float a = pixVoisin[index];
+        float b = (fraction == 0) ? a : *std::min_element(pixVoisin.begin() + index + 1, pixVoisin.end());
+        res.at<float>(i, j) = interpolateRank(a, b, fraction);
+    };
+
+    // window values of VFLOAT_WIDTH pixels: value k of pixel p is at k * VFLOAT_WIDTH + p
+    std::vector<float> windows(n * VFLOAT_WIDTH);
+    int index;
+    float fraction;
+    rankPosition(n, rank, index, fraction);
+
+    auto interiorRow = [&](int i, int jStart, int jEnd) -> int {
+        if (n > SORTING_NETWORK_MAX_SIZE)
+            return jStart;
+
+        float * out = res.ptr<float>(i);
+        int j = jStart;
+        for (; j + VFLOAT_WIDTH <= jEnd; j += VFLOAT_WIDTH) {
+            float * w = windows.data();
+            for (int x = -size; x <= size; x++) {
+                const float * in = image.ptr<float>(i + x) + j;
+                for (int y = -size; y <= size; y++, w += VFLOAT_WIDTH)
+                    vstore(w, vload(in + y));
+            }
+
+            for (int pass = 0; pass < n; pass++)
+                for (int k = pass % 2; k + 1 < n; k += 2) {
+                    float * lower = windows.data() + k * VFLOAT_WIDTH;
+                    float * upper = lower + VFLOAT_WIDTH;
+                    vfloat a = vload(lower);
+                    vfloat b = vload(upper);
+                    vstore(lower, vmin(a, b));
+                    vstore(upper, vmax(a, b));
+                }
+
+            vfloat a = vload(windows.data() + index * VFLOAT_WIDTH);
+            if (fraction != 0) {
+                vfloat b = vload(windows.data() + (index + 1) * VFLOAT_WIDTH);
+                a = vadd(vmul(vset(1 - fraction), a), vmul(vset(fraction), b));
+            }
+            vstore(out + j, a);
+        }
+        return j;
+    };
+
+    forEachPixelSplit(image.size(), NeighbourhoodExtent(size, size, size, size), rowStart, rowEnd, border, interiorRow);
+}
+
+/**
+    Compute a rank filter of the input float image.
+    The filter window is a square of (2*size+1)*(2*size+1) pixels.
+
+    Values outside image domain are ignored.
+
+    The result is the value at position rank*(n-1) in the sorted list l of the n values of
+    the window (rank=0 gives the minimum, rank=1 the maximum); when this position falls
+    between two indices i and i+1, the values l[i] and l[i+1] are linearly interpolated.
+
+    Images holding 8 bit data (see quantizedLevels) are processed in constant time per
+    pixel with sliding histograms, other images by sorting the windows. Bands of rows are
+    filtered in parallel; the histograms of a band are initialized with a whole window,
+    so the bands have at least as many rows as the window.
+*/
+Mat rankFilter(Mat image, int size, float rank)
+{
+    Mat res(image.size(), CV_32FC1);
+    rank = std::min(std::max(rank, 0.0f), 1.0f);
+
+    Mat levels;
+    if (quantizedLevels(image, levels)) {
+        Mat values = levelValues();
+        parallelRows(image.rows, [&](int rowStart, int rowEnd) {
+            histogramRankFilter(levels, values, size, rank, res, rowStart, rowEnd);
+        }, 2 * size + 1);
+    } else {
+        parallelRows(image.rows, [&](int rowStart, int rowEnd) {
+            sortingRankFilter(image, size, rank, res, rowStart, rowEnd);
+        });
+    }
+
+    return res;
+}
+
 /**
     Compute a median filter of the input float image.
     The filter window is a square of (2*size+1)*(2*size+1) pixels.
@@ -17,134 +337,1098 @@ using namespace std;
     The median of a list l of n>2 elements is defined as:
      - l[n/2] if n is odd 
      - (l[n/2-1]+l[n/2])/2 is n is even 
+
+    This is the rank filter of rank 1/2: for an even n, the interpolation of l[n/2-1] and
+    l[n/2] with weights 1/2 gives the same float value as (l[n/2-1]+l[n/2])/2.
 */
 Mat median(Mat image, int size)
 {
-    Mat res(image.size(), CV_32FC1);
-
     /********************************************
                 YOUR CODE HERE
     *********************************************/
+    Mat res = rankFilter(image, size, 0.5f);
+    /********************************************
+                END OF YOUR CODE
+    *********************************************/
+
+    return res;
+}
+
 
-    int i = 0;
-    while (i < image.rows) 
+
+
+/**
+    Minimum and maximum of two scalars or vectors, used to instantiate the
+    van Herk/Gil-Werman passes for erosion and dilation.
+*/
+struct MinOperator
+{
+    static float apply(float a, float b) { return std::min(a, b); }
+    static vfloat apply(vfloat a, vfloat b) { return vmin(a, b); }
+};
+
+struct MaxOperator
+{
+    static float apply(float a, float b) { return std::max(a, b); }
+    static vfloat apply(vfloat a, vfloat b) { return vmax(a, b); }
+};
+
+/**
+    Conventions of the erosion and dilation: the neighbours of a pixel are combined with Op,
+    pixels outside the image have the value padding(), and finish() gives the value of a
+    pixel from the result of Op over its padded neighbourhood. The structuring element of
+    size n is centered at radius(n) along each axis.
+*/
+struct Erosion
+{
+    typedef MinOperator Op;
+
+    static int radius(int size) { return (size - 1) / 2; }
+    static float padding() { return 1.0f; }
+    static float finish(float value) { return std::min(value, 1.0f); }
+};
+
+struct Dilation
+{
+    typedef MaxOperator Op;
+
+    static int radius(int size) { return size / 2; }
+    // pixels outside the image are ignored: a pixel without any neighbour in the image gets 0
+    static float padding() { return -std::numeric_limits<float>::infinity(); }
+    static float finish(float value) { return (value == -std::numeric_limits<float>::infinity()) ? 0 : value; }
+};
+
+template<typename Morphology>
+static CompiledStructuringElement compileStructuringElement(Mat structuringElement)
+{
+    return CompiledStructuringElement(structuringElement, Morphology::radius(structuringElement.rows),
+                                      Morphology::radius(structuringElement.cols));
+}
+
+// smallest structuring element processed with the van Herk/Gil-Werman algorithm:
+// below, the vectorized direct computation is faster
+static const int VAN_HERK_MIN_SIZE = 15;
+// smallest structuring element processed with the chord algorithm
+static const int CHORD_MIN_SIZE = 15;
+
+/**
+    out[x] = Op over in[x + first] ... in[x + last] for the rows of cols pixels, pixels
+    outside the row having the value padding.
+
+    Van Herk/Gil-Werman algorithm: the padded row is cut in blocks of length
+    L = last - first + 1, and every window of L pixels is made of the end of a block and
+    the beginning of the next one. With the running extremum from the left of each block
+    (prefix) and from the right (suffix), each output costs 3 comparisons whatever L.
+*/
+template<typename Op>
+class VanHerkRow
+{
+public:
+    VanHerkRow(int cols, int first, int last, float padding)
+        : cols(cols), first(first), length(last - first + 1), padding(padding),
+          paddedLength((cols + length - 1 + length - 1) / length * length),
+          padded(paddedLength), prefix(paddedLength), suffix(paddedLength) {}
+
+    void apply(const float * in, float * out)
     {
-        int j = 0;
-        while (j < image.cols) 
+        // padded[i] is the pixel i + first of the row
+        for (int i = 0; i < paddedLength; i++) {
+            int x = i + first;
+            padded[i] = (x >= 0 && x < cols) ? in[x] : padding;
+        }
+
+        for (int start = 0; start < paddedLength; start += length) {
+            int end = start + length - 1;
+            prefix[start] = padded[start];
+            for (int i = start + 1; i <= end; i++)
+                prefix[i] = Op::apply(prefix[i - 1], padded[i]);
+            suffix[end] = padded[end];
+            for (int i = end - 1; i >= start; i--)
+                suffix[i] = Op::apply(suffix[i + 1], padded[i]);
+        }
+
+        for (int x = 0; x < cols; x++)
+            out[x] = Op::apply(suffix[x], prefix[x + length - 1]);
+    }
+
+private:
+    int cols, first, length;
+    float padding;
+    int paddedLength;
+    std::vector<float> padded, prefix, suffix;
+};
+
+/**
+    Maximum and minimum of windows of a row at once, for the morphological gradient:
+    maxOut[x] = max over in[x + maxFirst] ... in[x + maxLast] and minOut[x] = min over
+    in[x + minFirst] ... in[x + minLast], pixels outside the row having the values
+    maxPadding and minPadding.
+
+    The row is read once to fill the padded rows of both, then each one goes through the
+    passes of VanHerkRow with the blocks of its own window length (the windows of an even
+    sized element differ, see Erosion::radius).
+*/
+class VanHerkGradientRow
+{
+public:
+    VanHerkGradientRow(int cols, int maxFirst, int maxLast, int minFirst, int minLast, float maxPadding, float minPadding)
+        : cols(cols), maxBlocks(cols, maxFirst, maxLast, maxPadding), minBlocks(cols, minFirst, minLast, minPadding),
+          start(std::min(maxFirst, minFirst)), end(std::max(maxBlocks.last(), minBlocks.last())) {}
+
+    void apply(const float * in, float * maxOut, float * minOut)
+    {
+        for (int x = start; x <= end; x++) {
+            if (x >= 0 && x < cols) {
+                maxBlocks.set(x, in[x]);
+                minBlocks.set(x, in[x]);
+            } else {
+                maxBlocks.set(x, maxBlocks.padding);
+                minBlocks.set(x, minBlocks.padding);
+            }
+        }
+        maxBlocks.apply<MaxOperator>(maxOut);
+        minBlocks.apply<MinOperator>(minOut);
+    }
+
+private:
+    // padded row of VanHerkRow, position i being the pixel i + first
+    struct Blocks
+    {
+        int cols, first, length;
+        float padding;
+        int paddedLength;
+        std::vector<float> padded, prefix, suffix;
+
+        Blocks(int cols, int first, int last, float padding)
+            : cols(cols), first(first), length(last - first + 1), padding(padding),
+              paddedLength((cols + length - 1 + length - 1) / length * length),
+              padded(paddedLength), prefix(paddedLength), suffix(paddedLength) {}
+
+        // last pixel of the padded row
+        int last() const { return first + paddedLength - 1; }
+
+        void set(int x, float value)
         {
-            std::vector<float> pixVoisin;
-            int minLigne = std::max(i - size, 0);
-            int maxLigne = std::min(i + size, image.rows - 1);
-            int minColonne = std::max(j - size, 0);
-            int maxColonne = std::min(j + size, image.cols - 1);
-
-            int x = minLigne;
-            while (x <= maxLigne) 
-            {
-                int y = minColonne;
-                while (y <= maxColonne)    
-                {
-                    pixVoisin.push_back(image.at<float>(x, y));
-                    y++;
-                }
-                x++;
+            int i = x - first;
+            if (i >= 0 && i < paddedLength)
+                padded[i] = value;
+        }
+
+        template<typename Op>
+        void apply(float * out)
+        {
+            for (int start = 0; start < paddedLength; start += length) {
+                int end = start + length - 1;
+                prefix[start] = padded[start];
+                for (int i = start + 1; i <= end; i++)
+                    prefix[i] = Op::apply(prefix[i - 1], padded[i]);
+                suffix[end] = padded[end];
+                for (int i = end - 1; i >= start; i--)
+                    suffix[i] = Op::apply(suffix[i + 1], padded[i]);
             }
 
-            // Tri manuel des valeurs
-            int n = pixVoisin.size();
-            int m = 0;
-            while (m < n - 1) 
-            {
-                int k = 0;
-                while (k < n - m - 1) 
-                {
-                    switch (pixVoisin[k] > pixVoisin[k + 1]) 
-                    {
-                        case true:
-                            float temp = pixVoisin[k];
-                            pixVoisin[k] = pixVoisin[k + 1];
-                            pixVoisin[k + 1] = temp;
-                            break;
-                    }
-                    k++;
+            for (int x = 0; x < cols; x++)
+                out[x] = Op::apply(suffix[x], prefix[x + length - 1]);
+        }
+    };
+
+    int cols;
+    Blocks maxBlocks, minBlocks;
+    // pixels covered by the padded rows of both
+    int start, end;
+};
+
+/**
+    res(y, x) = Op over in(y, x + first) ... in(y, x + last), pixels outside the image
+    having the value padding (see VanHerkRow).
+*/
+template<typename Op>
+static void vanHerkHorizontal(Mat image, Mat res, int first, int last, float padding)
+{
+    parallelRows(image.rows, [&](int rowStart, int rowEnd) {
+        VanHerkRow<Op> pass(image.cols, first, last, padding);
+        for (int y = rowStart; y < rowEnd; y++)
+            pass.apply(image.ptr<float>(y), res.ptr<float>(y));
+    });
+}
+
+/**
+    Op of the rows a and b of n pixels into out.
+*/
+template<typename Op>
+static void rowOperator(const float * a, const float * b, float * out, int n)
+{
+    int x = 0;
+    for (; x + VFLOAT_WIDTH <= n; x += VFLOAT_WIDTH)
+        vstore(out + x, Op::apply(vload(a + x), vload(b + x)));
+    for (; x < n; x++)
+        out[x] = Op::apply(a[x], b[x]);
+}
+
+/**
+    res(y, x) = Op over in(y + first, x) ... in(y + last, x), pixels outside the image
+    having the value padding.
+
+    Same algorithm as VanHerkRow on the columns, processing whole rows at once:
+    the blocks are computed in parallel, then the bands of output rows.
+*/
+template<typename Op>
+static void vanHerkVertical(Mat image, Mat res, int first, int last, float padding)
+{
+    int length = last - first + 1;
+    int paddedLength = (image.rows + length - 1 + length - 1) / length * length;
+    int cols = image.cols;
+    std::vector<float> paddingRow(cols, padding);
+    Mat prefix(paddedLength, cols, CV_32FC1), suffix(paddedLength, cols, CV_32FC1);
+
+    // row i of the padded image is the row i + first of the image
+    auto padded = [&](int i) -> const float * {
+        int y = i + first;
+        return (y >= 0 && y < image.rows) ? image.ptr<float>(y) : paddingRow.data();
+    };
+
+    parallelRows(paddedLength / length, [&](int blockStart, int blockEnd) {
+        for (int start = blockStart * length; start < blockEnd * length; start += length) {
+            int end = start + length - 1;
+            std::copy(padded(start), padded(start) + cols, prefix.ptr<float>(start));
+            for (int i = start + 1; i <= end; i++)
+                rowOperator<Op>(prefix.ptr<float>(i - 1), padded(i), prefix.ptr<float>(i), cols);
+            std::copy(padded(end), padded(end) + cols, suffix.ptr<float>(end));
+            for (int i = end - 1; i >= start; i--)
+                rowOperator<Op>(suffix.ptr<float>(i + 1), padded(i), suffix.ptr<float>(i), cols);
+        }
+    });
+
+    parallelRows(image.rows, [&](int rowStart, int rowEnd) {
+        for (int y = rowStart; y < rowEnd; y++)
+            rowOperator<Op>(suffix.ptr<float>(y), prefix.ptr<float>(y + length - 1), res.ptr<float>(y), cols);
+    });
+}
+
+/**
+    Op over the rectangle box of offsets around each pixel, pixels outside the image
+    having the value padding: a horizontal pass followed by a vertical pass.
+*/
+template<typename Op>
+static Mat vanHerkRectangle(Mat image, Rect box, float padding)
+{
+    // box has at least VAN_HERK_MIN_SIZE pixels: at least one of the passes is done
+    Mat rows = image;
+    if (box.width > 1 || box.x != 0) {
+        rows = Mat(image.size(), CV_32FC1);
+        vanHerkHorizontal<Op>(image, rows, box.x, box.x + box.width - 1, padding);
+    }
+    if (box.height == 1 && box.y == 0)
+        return rows;
+
+    Mat res(image.size(), CV_32FC1);
+    vanHerkVertical<Op>(rows, res, box.y, box.y + box.height - 1, padding);
+    return res;
+}
+
+
+/**
+    Erosion or dilation with the chord algorithm of Urbach and Wilkinson, one row at a time.
+
+    For every input row, a table gives Op over the runs of pixels of each chord length,
+    starting at each position; it is built by doubling the run lengths from the powers of
+    two. Each output pixel then combines one table value per chord. The tables of the
+    box.height last input rows are kept in a ring: input rows are added in increasing
+    order with addRow, starting from any row, and the output row y can be computed by
+    apply once the input rows from firstRow(y) (clamped to 0) up to lastRow(y) have been
+    added, and no more than extraRows rows after lastRow(y). The cost per pixel is the
+    number of chords (about the square root of the number of elements for convex shapes)
+    plus the number of distinct lengths.
+*/
+template<typename Morphology>
+class ChordTables
+{
+public:
+    ChordTables(const CompiledStructuringElement & se, Size size, int extraRows=0)
+        : chords(se.chords), box(se.box), rows(size.height), cols(size.width), tableWidth(cols + box.width - 1),
+          ringRows(box.height + extraRows)
+    {
+        // chord lengths and the powers of two below them, in increasing order
+        int maxLength = 0;
+        for (const Chord & chord : chords)
+            maxLength = std::max(maxLength, chord.length);
+        for (int p = 1; p < maxLength; p *= 2)
+            lengths.push_back(p);
+        for (const Chord & chord : chords)
+            lengths.push_back(chord.length);
+        std::sort(lengths.begin(), lengths.end());
+        lengths.erase(std::unique(lengths.begin(), lengths.end()), lengths.end());
+
+        // run of length lengths[k] = Op(run of length base, run of length base shifted by lengths[k] - base)
+        // with base the largest power of two below lengths[k]
+        baseIndex.assign(lengths.size(), 0);
+        for (size_t k = 1; k < lengths.size(); k++) {
+            int base = 1;
+            while (2 * base < lengths[k])
+                base *= 2;
+            baseIndex[k] = std::lower_bound(lengths.begin(), lengths.end(), base) - lengths.begin();
+        }
+        for (const Chord & chord : chords)
+            chordIndex.push_back(std::lower_bound(lengths.begin(), lengths.end(), chord.length) - lengths.begin());
+
+        if (chords.empty())
+            return;
+        tables.resize(ringRows);
+        for (Mat & table : tables)
+            table = Mat(lengths.size(), tableWidth, CV_32FC1);
+        paddingTable = Mat(lengths.size(), tableWidth, CV_32FC1, Scalar(Morphology::padding()));
+    }
+
+    // first and last input rows needed by the output row y
+    int firstRow(int y) const { return y + box.y; }
+    int lastRow(int y) const { return y + box.y + box.height - 1; }
+
+    void addRow(int y, const float * in)
+    {
+        if (chords.empty())
+            return;
+        Mat & table = tables[y % ringRows];
+        // table position u holds the runs starting at pixel x = u + box.x
+        float * run = table.ptr<float>(0);
+        for (int u = 0; u < tableWidth; u++) {
+            int x = u + box.x;
+            run[u] = (x >= 0 && x < cols) ? in[x] : Morphology::padding();
+        }
+        for (size_t k = 1; k < lengths.size(); k++) {
+            const float * base = table.ptr<float>(baseIndex[k]);
+            int shift = lengths[k] - lengths[baseIndex[k]];
+            rowOperator<typename Morphology::Op>(base, base + shift, table.ptr<float>(k), tableWidth - lengths[k] + 1);
+        }
+    }
+
+    void apply(int y, float * out) const
+    {
+        std::fill(out, out + cols, Morphology::padding());
+        for (size_t c = 0; c < chords.size(); c++) {
+            const Chord & chord = chords[c];
+            const float * run = runs(y + chord.dy, chordIndex[c]) + chord.dx - box.x;
+            if (c == 0)
+                std::copy(run, run + cols, out);
+            else
+                rowOperator<typename Morphology::Op>(out, run, out, cols);
+        }
+        for (int x = 0; x < cols; x++)
+            out[x] = Morphology::finish(out[x]);
+    }
+
+private:
+    vector<Chord> chords;
+    Rect box;
+    int rows, cols, tableWidth, ringRows;
+    vector<int> lengths, baseIndex, chordIndex;
+    vector<Mat> tables;
+    Mat paddingTable;
+
+    // runs of length lengths[k] of the input row y
+    const float * runs(int y, int k) const
+    {
+        const Mat & table = (y >= 0 && y < rows) ? tables[y % ringRows] : paddingTable;
+        return table.ptr<float>(k);
+    }
+};
+
+/**
+    Bands of rows are processed in parallel, each with its own tables filled from the
+    first input row of the band.
+*/
+template<typename Morphology>
+static Mat chordMorphology(Mat image, const CompiledStructuringElement & se)
+{
+    Mat res(image.size(), CV_32FC1);
+
+    parallelRows(image.rows, [&](int rowStart, int rowEnd) {
+        ChordTables<Morphology> tables(se, image.size());
+        int inputRow = std::max(tables.firstRow(rowStart), 0);
+        for (int y = rowStart; y < rowEnd; y++) {
+            for (; inputRow <= std::min(tables.lastRow(y), image.rows - 1); inputRow++)
+                tables.addRow(inputRow, image.ptr<float>(inputRow));
+            tables.apply(y, res.ptr<float>(y));
+        }
+    }, se.box.height);
+
+    return res;
+}
+
+enum MorphologyAlgorithm { MORPHOLOGY_DIRECT, MORPHOLOGY_VAN_HERK, MORPHOLOGY_CHORD };
+
+/**
+    Fastest algorithm for an erosion or a dilation by se: van Herk/Gil-Werman for large
+    rectangles, chords for other large shapes made of long enough chords, and the direct
+    computation otherwise.
+*/
+static MorphologyAlgorithm morphologyAlgorithm(const CompiledStructuringElement & se)
+{
+    int size = se.offsets.size();
+    if (se.rectangle && size >= VAN_HERK_MIN_SIZE)
+        return MORPHOLOGY_VAN_HERK;
+    if (size >= CHORD_MIN_SIZE && (int)se.chords.size() * 2 <= size)
+        return MORPHOLOGY_CHORD;
+    return MORPHOLOGY_DIRECT;
+}
+
+/**
+    Erosion or dilation, when the structuring element is large enough for the van Herk/Gil-Werman
+    (rectangles) or the chord (other shapes) algorithms to be faster than the direct
+    computation. Returns an empty matrix otherwise.
+*/
+template<typename Morphology>
+static Mat sublinearMorphology(Mat image, const CompiledStructuringElement & se)
+{
+    switch (morphologyAlgorithm(se)) {
+    case MORPHOLOGY_VAN_HERK: {
+        Mat res = vanHerkRectangle<typename Morphology::Op>(image, se.box, Morphology::padding());
+        res.forEach<float>([](float & pix, const int *) {
+            pix = Morphology::finish(pix);
+        });
+        return res;
+    }
+    case MORPHOLOGY_CHORD:
+        return chordMorphology<Morphology>(image, se);
+    default:
+        return Mat();
+    }
+}
+
+/**
+    Rows of an image produced one after the other, from a first row to the last.
+*/
+class RowStream
+{
+public:
+    virtual ~RowStream() {}
+
+    // next row, valid until the following call
+    virtual const float * next() = 0;
+};
+
+class ImageRowStream : public RowStream
+{
+public:
+    ImageRowStream(Mat image, int firstRow) : image(image), y(firstRow) {}
+
+    const float * next() { return image.ptr<float>(y++); }
+
+private:
+    Mat image;
+    int y;
+};
+
+/**
+    Erosion or dilation of the rows of another stream with the chord algorithm: the input
+    image is only kept in the chord tables of the rows covered by the structuring element.
+*/
+template<typename Morphology>
+class ChordRowStream : public RowStream
+{
+public:
+    ChordRowStream(RowStream & input, const CompiledStructuringElement & se, Size size, int firstRow)
+        : input(input), tables(se, size), rows(size.height), row(size.width),
+          inputRow(std::max(tables.firstRow(firstRow), 0)), outputRow(firstRow) {}
+
+    const float * next()
+    {
+        for (; inputRow <= std::min(tables.lastRow(outputRow), rows - 1); inputRow++)
+            tables.addRow(inputRow, input.next());
+        tables.apply(outputRow++, row.data());
+        return row.data();
+    }
+
+private:
+    RowStream & input;
+    ChordTables<Morphology> tables;
+    int rows;
+    vector<float> row;
+    int inputRow, outputRow;
+};
+
+/**
+    Erosion or dilation of the rows of another stream by a rectangle, with the van
+    Herk/Gil-Werman algorithm: each input row goes through the horizontal pass (see
+    VanHerkRow), and the vertical pass is done on blocks of box.height rows starting at the
+    first output row. The suffixes of the current block and the prefixes of the next one
+    are kept, so the stream holds about three blocks of rows.
+*/
+template<typename Morphology>
+class VanHerkRowStream : public RowStream
+{
+public:
+    VanHerkRowStream(RowStream & input, const CompiledStructuringElement & se, Size size, int firstRow)
+        : input(input), rows(size.height), cols(size.width), length(se.box.height),
+          horizontal(se.box.width > 1 || se.box.x != 0),
+          horizontalPass(cols, se.box.x, se.box.x + se.box.width - 1, Morphology::padding()),
+          block(length, cols, CV_32FC1), prefix(length, cols, CV_32FC1), suffix(length, cols, CV_32FC1),
+          row(cols), inputRow(firstRow + se.box.y), loaded(0), position(0)
+    {
+        nextBlock();
+    }
+
+    const float * next()
+    {
+        if (position == length)
+            nextBlock();
+        // output row = Op over the rows position ... length - 1 of the current block
+        // and 0 ... position - 1 of the next one
+        if (position == 0) {
+            std::copy(suffix.ptr<float>(0), suffix.ptr<float>(0) + cols, row.begin());
+        } else {
+            while (loaded < position)
+                loadRow();
+            rowOperator<typename Morphology::Op>(suffix.ptr<float>(position), prefix.ptr<float>(position - 1), row.data(), cols);
+        }
+        position++;
+        for (float & pix : row)
+            pix = Morphology::finish(pix);
+        return row.data();
+    }
+
+private:
+    RowStream & input;
+    int rows, cols, length;
+    bool horizontal;
+    VanHerkRow<typename Morphology::Op> horizontalPass;
+    // rows of the next block after the horizontal pass, and their running extremum from the top
+    Mat block, prefix;
+    // running extremum from the bottom of the current block
+    Mat suffix;
+    vector<float> row;
+    // next input row, rows of the next block loaded, position of the next output row in the current block
+    int inputRow, loaded, position;
+
+    void loadRow()
+    {
+        float * out = block.ptr<float>(loaded);
+        if (inputRow < 0 || inputRow >= rows)
+            std::fill(out, out + cols, Morphology::padding());
+        else if (horizontal)
+            horizontalPass.apply(input.next(), out);
+        else {
+            const float * in = input.next();
+            std::copy(in, in + cols, out);
+        }
+        inputRow++;
+
+        if (loaded == 0)
+            std::copy(out, out + cols, prefix.ptr<float>(0));
+        else
+            rowOperator<typename Morphology::Op>(prefix.ptr<float>(loaded - 1), out, prefix.ptr<float>(loaded), cols);
+        loaded++;
+    }
+
+    // the next block becomes the current one
+    void nextBlock()
+    {
+        while (loaded < length)
+            loadRow();
+        std::copy(block.ptr<float>(length - 1), block.ptr<float>(length - 1) + cols, suffix.ptr<float>(length - 1));
+        for (int i = length - 2; i >= 0; i--)
+            rowOperator<typename Morphology::Op>(suffix.ptr<float>(i + 1), block.ptr<float>(i), suffix.ptr<float>(i), cols);
+        loaded = 0;
+        position = 0;
+    }
+};
+
+/**
+    Erosion or dilation of the rows of another stream by a small structuring element: the
+    box.height last input rows are kept in a ring, padded on both sides, and every output
+    row combines one shifted input row per element.
+*/
+template<typename Morphology>
+class DirectRowStream : public RowStream
+{
+public:
+    DirectRowStream(RowStream & input, const CompiledStructuringElement & se, Size size, int firstRow)
+        : input(input), offsets(se.offsets), box(se.box), rows(size.height), cols(size.width),
+          ringWidth(cols + box.width - 1), row(cols), firstInputRow(firstRow + box.y),
+          inputRow(firstInputRow), outputRow(firstRow)
+    {
+        if (!offsets.empty())
+            ring = Mat(box.height, ringWidth, CV_32FC1, Scalar(Morphology::padding()));
+    }
+
+    const float * next()
+    {
+        int y = outputRow++;
+        if (offsets.empty()) {
+            std::fill(row.begin(), row.end(), Morphology::finish(Morphology::padding()));
+            return row.data();
+        }
+        for (; inputRow <= y + box.y + box.height - 1; inputRow++) {
+            // ring position u holds the pixel x = u + box.x
+            float * padded = ring.ptr<float>(slot(inputRow));
+            if (inputRow < 0 || inputRow >= rows)
+                std::fill(padded, padded + ringWidth, Morphology::padding());
+            else {
+                const float * in = input.next();
+                for (int u = 0; u < ringWidth; u++) {
+                    int x = u + box.x;
+                    padded[u] = (x >= 0 && x < cols) ? in[x] : Morphology::padding();
                 }
-                m++;
             }
+        }
+
+        for (size_t k = 0; k < offsets.size(); k++) {
+            const float * in = ring.ptr<float>(slot(y + offsets[k].y)) + offsets[k].x - box.x;
+            if (k == 0)
+                std::copy(in, in + cols, row.begin());
+            else
+                rowOperator<typename Morphology::Op>(row.data(), in, row.data(), cols);
+        }
+        for (float & pix : row)
+            pix = Morphology::finish(pix);
+        return row.data();
+    }
+
+private:
+    RowStream & input;
+    vector<Point> offsets;
+    Rect box;
+    int rows, cols, ringWidth;
+    Mat ring;
+    vector<float> row;
+    int firstInputRow, inputRow, outputRow;
+
+    int slot(int y) const { return (y - firstInputRow) % box.height; }
+};
+
+/**
+    Erosion or dilation of the rows of input by se, with the algorithm chosen by
+    morphologyAlgorithm. The output starts at row firstRow, and the input stream must start
+    at the first row it needs, max(firstRow + se.box.y, 0).
+*/
+template<typename Morphology>
+static std::unique_ptr<RowStream> morphologyRowStream(RowStream & input, const CompiledStructuringElement & se, Size size, int firstRow)
+{
+    switch (morphologyAlgorithm(se)) {
+    case MORPHOLOGY_VAN_HERK:
+        return std::unique_ptr<RowStream>(new VanHerkRowStream<Morphology>(input, se, size, firstRow));
+    case MORPHOLOGY_CHORD:
+        return std::unique_ptr<RowStream>(new ChordRowStream<Morphology>(input, se, size, firstRow));
+    default:
+        return std::unique_ptr<RowStream>(new DirectRowStream<Morphology>(input, se, size, firstRow));
+    }
+}
+
+/**
+    res[x] = Dilation::finish(dilation[x]) - Erosion::finish(erosion[x]) for n pixels.
+*/
+static void gradientRow(const float * dilation, const float * erosion, float * res, int n)
+{
+    for (int x = 0; x < n; x++)
+        res[x] = Dilation::finish(dilation[x]) - Erosion::finish(erosion[x]);
+}
+
+/**
+    Morphological gradient of the rows of another stream by a small structuring element:
+    the dilation and the erosion are computed together from a ring of the input rows.
 
-            float mediane = 0;
-            if (n % 2 == 0) 
-            {
-                mediane = (pixVoisin[n / 2 - 1] + pixVoisin[n / 2]) / 2;
+    The offsets of the dilation and erosion elements are merged (they only differ for even
+    sizes, see Erosion::radius), and every offset shared by the two loads its shifted input
+    row once for the maximum and the minimum. Pixels outside the image are skipped rather
+    than padded, the maximum starting from Dilation::padding() and the minimum from
+    Erosion::padding().
+*/
+class DirectGradientRowStream : public RowStream
+{
+public:
+    DirectGradientRowStream(RowStream & input, const CompiledStructuringElement & dilationElement,
+                            const CompiledStructuringElement & erosionElement, Size size, int firstRow)
+        : input(input), box(dilationElement.box | erosionElement.box), rows(size.height), cols(size.width),
+          maxRow(cols), minRow(cols), row(cols), firstInputRow(firstRow + box.y),
+          inputRow(firstInputRow), outputRow(firstRow)
+    {
+        // both offset lists are in row-major order
+        const vector<Point> & dilationOffsets = dilationElement.offsets;
+        const vector<Point> & erosionOffsets = erosionElement.offsets;
+        auto before = [](Point a, Point b) { return a.y < b.y || (a.y == b.y && a.x < b.x); };
+        size_t i = 0, j = 0;
+        while (i < dilationOffsets.size() || j < erosionOffsets.size()) {
+            if (j == erosionOffsets.size() || (i < dilationOffsets.size() && before(dilationOffsets[i], erosionOffsets[j])))
+                offsets.push_back(GradientOffset(dilationOffsets[i++], true, false));
+            else if (i == dilationOffsets.size() || before(erosionOffsets[j], dilationOffsets[i]))
+                offsets.push_back(GradientOffset(erosionOffsets[j++], false, true));
+            else {
+                offsets.push_back(GradientOffset(dilationOffsets[i++], true, true));
+                j++;
             }
-            else 
-            {
-                mediane = pixVoisin[n / 2];
+        }
+        if (!offsets.empty())
+            ring = Mat(box.height, cols, CV_32FC1);
+    }
+
+    const float * next()
+    {
+        int y = outputRow++;
+        for (; !offsets.empty() && inputRow <= y + box.y + box.height - 1; inputRow++) {
+            if (inputRow >= 0 && inputRow < rows) {
+                const float * in = input.next();
+                std::copy(in, in + cols, ring.ptr<float>(slot(inputRow)));
             }
+        }
 
-            res.at<float>(i, j) = mediane;
-            j++;
+        std::fill(maxRow.begin(), maxRow.end(), Dilation::padding());
+        std::fill(minRow.begin(), minRow.end(), Erosion::padding());
+        for (const GradientOffset & o : offsets) {
+            int inputY = y + o.offset.y;
+            // pixels [start, end[ of the output row, whose shifted pixel is in the image
+            int start = std::max(0, -o.offset.x), end = std::min(cols, cols - o.offset.x);
+            if (inputY < 0 || inputY >= rows || start >= end)
+                continue;
+            const float * in = ring.ptr<float>(slot(inputY)) + start + o.offset.x;
+            if (o.dilation && o.erosion)
+                extremaRow(in, maxRow.data() + start, minRow.data() + start, end - start);
+            else if (o.dilation)
+                rowOperator<MaxOperator>(maxRow.data() + start, in, maxRow.data() + start, end - start);
+            else
+                rowOperator<MinOperator>(minRow.data() + start, in, minRow.data() + start, end - start);
         }
-        i++;
+        gradientRow(maxRow.data(), minRow.data(), row.data(), cols);
+        return row.data();
     }
-    /********************************************
-                END OF YOUR CODE
-    *********************************************/
 
-    return res;
+private:
+    // offset of the dilation element, of the erosion element or of both
+    struct GradientOffset
+    {
+        Point offset;
+        bool dilation, erosion;
+
+        GradientOffset(Point offset, bool dilation, bool erosion) : offset(offset), dilation(dilation), erosion(erosion) {}
+    };
+
+    RowStream & input;
+    vector<GradientOffset> offsets;
+    // bounding box of both elements
+    Rect box;
+    int rows, cols;
+    // the box.height last input rows
+    Mat ring;
+    vector<float> maxRow, minRow, row;
+    int firstInputRow, inputRow, outputRow;
+
+    int slot(int y) const { return (y - firstInputRow) % box.height; }
+
+    // maxRow = max(maxRow, in) and minRow = min(minRow, in) for n pixels, each value of in loaded once
+    static void extremaRow(const float * in, float * maxRow, float * minRow, int n)
+    {
+        int x = 0;
+        for (; x + VFLOAT_WIDTH <= n; x += VFLOAT_WIDTH) {
+            vfloat pix = vload(in + x);
+            vstore(maxRow + x, vmax(vload(maxRow + x), pix));
+            vstore(minRow + x, vmin(vload(minRow + x), pix));
+        }
+        for (; x < n; x++) {
+            maxRow[x] = std::max(maxRow[x], in[x]);
+            minRow[x] = std::min(minRow[x], in[x]);
+        }
+    }
+};
+
+/**
+    Vertical pass of the van Herk/Gil-Werman algorithm on rows pushed one after the other:
+    the output rows are Op over length consecutive rows, the window of the first output
+    row starting at the first row pushed (see VanHerkRowStream). The rows must be pushed
+    up to the last row of the window before computing it with next, and at most
+    extraRows further rows can be pushed ahead.
+*/
+template<typename Op>
+class VanHerkVerticalPass
+{
+public:
+    VanHerkVerticalPass(int length, int cols, int extraRows)
+        : length(length), cols(cols), block(length + extraRows, cols, CV_32FC1),
+          prefix(length, cols, CV_32FC1), suffix(length, cols, CV_32FC1), loaded(0), position(length) {}
+
+    // row to fill with the next input row before calling push
+    float * nextRow() { return block.ptr<float>(loaded); }
+
+    void push()
+    {
+        if (loaded < length)
+            updatePrefix(loaded);
+        loaded++;
+    }
+
+    void next(float * out)
+    {
+        if (position == length)
+            nextBlock();
+        // Op over the rows position ... length - 1 of the current block and 0 ... position - 1 of the next one
+        if (position == 0)
+            std::copy(suffix.ptr<float>(0), suffix.ptr<float>(0) + cols, out);
+        else
+            rowOperator<Op>(suffix.ptr<float>(position), prefix.ptr<float>(position - 1), out, cols);
+        position++;
+    }
+
+private:
+    int length, cols;
+    // rows of the next block and the rows pushed ahead, and their running extremum from the top
+    Mat block, prefix;
+    // running extremum from the bottom of the current block
+    Mat suffix;
+    // rows of block pushed, position of the next output row in the current block
+    int loaded, position;
+
+    void updatePrefix(int i)
+    {
+        if (i == 0)
+            std::copy(block.ptr<float>(0), block.ptr<float>(0) + cols, prefix.ptr<float>(0));
+        else
+            rowOperator<Op>(prefix.ptr<float>(i - 1), block.ptr<float>(i), prefix.ptr<float>(i), cols);
+    }
+
+    // the next block becomes the current one, the rows pushed ahead starting the following one
+    void nextBlock()
+    {
+        std::copy(block.ptr<float>(length - 1), block.ptr<float>(length - 1) + cols, suffix.ptr<float>(length - 1));
+        for (int i = length - 2; i >= 0; i--)
+            rowOperator<Op>(suffix.ptr<float>(i + 1), block.ptr<float>(i), suffix.ptr<float>(i), cols);
+        int ahead = loaded - length;
+        for (int i = 0; i < ahead; i++) {
+            std::copy(block.ptr<float>(length + i), block.ptr<float>(length + i) + cols, block.ptr<float>(i));
+            updatePrefix(i);
+        }
+        loaded = ahead;
+        position = 0;
+    }
+};
+
+/**
+    Morphological gradient of the rows of another stream by a rectangle, with the van
+    Herk/Gil-Werman algorithm computing the maximum and the minimum together: each input
+    row goes once through the horizontal pass of both (see VanHerkGradientRow), and is
+    pushed to the vertical passes of the dilation and of the erosion.
+
+    The input rows are loaded up to the last row of the windows of the output row: the
+    windows of an even sized element end at the same row or one row apart, and the pass
+    whose window ends first receives this row ahead.
+*/
+class VanHerkGradientRowStream : public RowStream
+{
+public:
+    VanHerkGradientRowStream(RowStream & input, const CompiledStructuringElement & dilationElement,
+                             const CompiledStructuringElement & erosionElement, Size size, int firstRow)
+        : input(input), rows(size.height), cols(size.width),
+          dilationFirstRow(firstRow + dilationElement.box.y), erosionFirstRow(firstRow + erosionElement.box.y),
+          lastOffset(std::max(lastOffsetY(dilationElement), lastOffsetY(erosionElement))),
+          horizontal(dilationElement.box.width > 1 || dilationElement.box.x != 0
+                     || erosionElement.box.width > 1 || erosionElement.box.x != 0),
+          horizontalPass(cols, dilationElement.box.x, dilationElement.box.x + dilationElement.box.width - 1,
+                         erosionElement.box.x, erosionElement.box.x + erosionElement.box.width - 1,
+                         Dilation::padding(), Erosion::padding()),
+          dilation(dilationElement.box.height, cols, lastOffset - lastOffsetY(dilationElement)),
+          erosion(erosionElement.box.height, cols, lastOffset - lastOffsetY(erosionElement)),
+          maxRow(cols), minRow(cols), row(cols),
+          inputRow(std::min(dilationFirstRow, erosionFirstRow)), outputRow(firstRow) {}
+
+    const float * next()
+    {
+        for (; inputRow <= outputRow + lastOffset; inputRow++)
+            loadRow();
+        dilation.next(maxRow.data());
+        erosion.next(minRow.data());
+        outputRow++;
+        gradientRow(maxRow.data(), minRow.data(), row.data(), cols);
+        return row.data();
+    }
+
+private:
+    RowStream & input;
+    int rows, cols;
+    // first input rows of the windows of both, last offset of the windows
+    int dilationFirstRow, erosionFirstRow, lastOffset;
+    bool horizontal;
+    VanHerkGradientRow horizontalPass;
+    VanHerkVerticalPass<MaxOperator> dilation;
+    VanHerkVerticalPass<MinOperator> erosion;
+    vector<float> maxRow, minRow, row;
+    int inputRow, outputRow;
+
+    static int lastOffsetY(const CompiledStructuringElement & se) { return se.box.y + se.box.height - 1; }
+
+    void loadRow()
+    {
+        // a row before the first one of a window is computed but not pushed
+        bool toDilation = inputRow >= dilationFirstRow, toErosion = inputRow >= erosionFirstRow;
+        float * maxOut = toDilation ? dilation.nextRow() : maxRow.data();
+        float * minOut = toErosion ? erosion.nextRow() : minRow.data();
+        if (inputRow < 0 || inputRow >= rows) {
+            std::fill(maxOut, maxOut + cols, Dilation::padding());
+            std::fill(minOut, minOut + cols, Erosion::padding());
+        } else if (horizontal)
+            horizontalPass.apply(input.next(), maxOut, minOut);
+        else {
+            const float * in = input.next();
+            std::copy(in, in + cols, maxOut);
+            std::copy(in, in + cols, minOut);
+        }
+        if (toDilation)
+            dilation.push();
+        if (toErosion)
+            erosion.push();
+    }
+};
+
+/**
+    Morphological gradient of the rows of another stream with the chord algorithm: each
+    input row is read once and added to the chord tables of the dilation and of the
+    erosion. Unlike the direct and van Herk streams, the two tables are not built in the
+    same pass: the runs of each chord length are maxima in one and minima in the other,
+    from rows padded with different values. The tables whose windows end first keep the
+    rows added ahead for the other one.
+*/
+class ChordGradientRowStream : public RowStream
+{
+public:
+    ChordGradientRowStream(RowStream & input, const CompiledStructuringElement & dilationElement,
+                           const CompiledStructuringElement & erosionElement, Size size, int firstRow)
+        : input(input), lastOffset(std::max(lastOffsetY(dilationElement), lastOffsetY(erosionElement))),
+          dilationTables(dilationElement, size, lastOffset - lastOffsetY(dilationElement)),
+          erosionTables(erosionElement, size, lastOffset - lastOffsetY(erosionElement)),
+          rows(size.height), maxRow(size.width), minRow(size.width), row(size.width),
+          inputRow(std::max(std::min(dilationTables.firstRow(firstRow), erosionTables.firstRow(firstRow)), 0)),
+          outputRow(firstRow) {}
+
+    const float * next()
+    {
+        for (; inputRow <= std::min(outputRow + lastOffset, rows - 1); inputRow++) {
+            const float * in = input.next();
+            dilationTables.addRow(inputRow, in);
+            erosionTables.addRow(inputRow, in);
+        }
+        dilationTables.apply(outputRow, maxRow.data());
+        erosionTables.apply(outputRow, minRow.data());
+        outputRow++;
+        for (size_t x = 0; x < row.size(); x++)
+            row[x] = maxRow[x] - minRow[x];
+        return row.data();
+    }
+
+private:
+    RowStream & input;
+    int lastOffset;
+    ChordTables<Dilation> dilationTables;
+    ChordTables<Erosion> erosionTables;
+    int rows;
+    vector<float> maxRow, minRow, row;
+    int inputRow, outputRow;
+
+    static int lastOffsetY(const CompiledStructuringElement & se) { return se.box.y + se.box.height - 1; }
+};
+
+/**
+    Morphological gradient of the rows of input by the dilation and erosion elements
+    compiled from the same structuring element, with the algorithm chosen by
+    morphologyAlgorithm. The output starts at row firstRow, and the input stream must start
+    at the first row it needs, max(firstRow + (dilationElement.box | erosionElement.box).y, 0).
+
+    An even-sized element whose ones are all in its last row or column compiles to an empty
+    erosion element: only the direct stream handles it, and the empty box of the erosion
+    element does not count in the first row.
+*/
+static std::unique_ptr<RowStream> gradientRowStream(RowStream & input, const CompiledStructuringElement & dilationElement,
+                                                    const CompiledStructuringElement & erosionElement, Size size, int firstRow)
+{
+    MorphologyAlgorithm algorithm = erosionElement.offsets.empty() ? MORPHOLOGY_DIRECT : morphologyAlgorithm(dilationElement);
+    switch (algorithm) {
+    case MORPHOLOGY_VAN_HERK:
+        return std::unique_ptr<RowStream>(new VanHerkGradientRowStream(input, dilationElement, erosionElement, size, firstRow));
+    case MORPHOLOGY_CHORD:
+        return std::unique_ptr<RowStream>(new ChordGradientRowStream(input, dilationElement, erosionElement, size, firstRow));
+    default:
+        return std::unique_ptr<RowStream>(new DirectGradientRowStream(input, dilationElement, erosionElement, size, firstRow));
+    }
 }
 
+/**
+    Second(First(image)) streamed row by row: the intermediate image never exists as a
+    whole, only as the rows kept by the second stream (see morphologyRowStream).
 
+    Bands of rows are streamed in parallel: the first pass of a band starts at the first
+    row read by the second pass, recomputing the rows shared with the previous band.
+*/
+template<typename First, typename Second>
+static Mat streamedComposition(Mat image, Mat structuringElement)
+{
+    CompiledStructuringElement firstElement = compileStructuringElement<First>(structuringElement);
+    CompiledStructuringElement secondElement = compileStructuringElement<Second>(structuringElement);
+
+    Mat res(image.size(), CV_32FC1);
+    parallelRows(image.rows, [&](int rowStart, int rowEnd) {
+        int firstPassRow = std::max(rowStart + secondElement.box.y, 0);
+        int sourceRow = std::max(firstPassRow + firstElement.box.y, 0);
+        ImageRowStream source(image, sourceRow);
+        std::unique_ptr<RowStream> firstPass = morphologyRowStream<First>(source, firstElement, image.size(), firstPassRow);
+        std::unique_ptr<RowStream> secondPass = morphologyRowStream<Second>(*firstPass, secondElement, image.size(), rowStart);
+
+        for (int y = rowStart; y < rowEnd; y++) {
+            const float * row = secondPass->next();
+            std::copy(row, row + image.cols, res.ptr<float>(y));
+        }
+    }, firstElement.box.height + secondElement.box.height);
+    return res;
+}
 
 
 /**
     Compute the dilation of the input float image by the given structuring element.
      Pixel outside the image are supposed to have value 0
+
+    Large rectangular structuring elements (including horizontal and vertical lines) are
+    processed with the van Herk/Gil-Werman algorithm, in constant time per pixel, and other
+    large shapes with the chord algorithm (see ChordTables).
 */
 Mat dilate(Mat image, Mat structuringElement)
 {
-    Mat res(image.size(), CV_32FC1);
+    Mat res = Mat::zeros(image.size(), CV_32FC1);
 
-    int largeurElementStructur =structuringElement.rows/2;
-    int hauteurElementStructur =structuringElement.cols/2;
-
-    // parcours chaque elem du res pixel
-    res.forEach<float>([&](float& pix, const int* pos) {
-        int debut = pos[0];
-        int fin= pos[1];
-
-        // initialisation de vecteur pour stocker les val des pix nearbor
-        std::vector<float> nbPix ={};
-
-        int premier =-largeurElementStructur;
-        while (premier <= largeurElementStructur) {
-            int deuxieme= -hauteurElementStructur;
-            while (deuxieme<= hauteurElementStructur) {
-                int xDehors = premier + largeurElementStructur;
-                int yDehors = deuxieme+ hauteurElementStructur;
-
-                if (debut+premier >= 0 && debut + premier < image.rows && fin+ deuxieme>= 0 && fin+ deuxieme< image.cols) {
-                    float valStruc = structuringElement.at<float>(xDehors, yDehors);
-                    
-                    if (valStruc==1) {
-                        nbPix.push_back(image.at<float>(debut + premier, fin+deuxieme));
-                    }
-                }
-                deuxieme++;
+    int largeurElementStructur = Dilation::radius(structuringElement.rows);
+    int hauteurElementStructur = Dilation::radius(structuringElement.cols);
+    CompiledStructuringElement se(structuringElement, largeurElementStructur, hauteurElementStructur);
+    const vector<Point> & offsets = se.offsets;
+    if (offsets.empty())
+        return res;
+
+    Mat fast = sublinearMorphology<Dilation>(image, se);
+    if (!fast.empty())
+        return fast;
+
+    auto border = [&](int ligne, int colonne) {
+        bool found = false;
+        float max = 0;
+        for (const Point & offset : offsets) {
+            int ligneImage = ligne + offset.y;
+            int colonneImage = colonne + offset.x;
+            if (ligneImage >= 0 && ligneImage < image.rows && colonneImage >= 0 && colonneImage < image.cols) {
+                float valeurPixel = image.at<float>(ligneImage, colonneImage);
+                if (!found || valeurPixel > max)
+                    max = valeurPixel;
+                found = true;
             }
-            premier++;
         }
+        res.at<float>(ligne, colonne) = max;
+    };
 
-        if (nbPix.size()>0) {
-            float max = nbPix[0];
-            size_t trie = 1;
-            while (trie<nbPix.size()) {
-                if (nbPix[trie] > max) {
-                    max = nbPix[trie];
-                }
-                trie++;
-            }
-        pix = max;
+    auto interiorRow = [&](int ligne, int colonneStart, int colonneEnd) -> int {
+        float * out = res.ptr<float>(ligne);
+        int colonne = colonneStart;
+        for (; colonne + VFLOAT_WIDTH <= colonneEnd; colonne += VFLOAT_WIDTH) {
+            vfloat max = vload(image.ptr<float>(ligne + offsets[0].y) + colonne + offsets[0].x);
+            for (size_t k = 1; k < offsets.size(); k++)
+                max = vmax(max, vload(image.ptr<float>(ligne + offsets[k].y) + colonne + offsets[k].x));
+            vstore(out + colonne, max);
         }
+        return colonne;
+    };
+
+    NeighbourhoodExtent extent(largeurElementStructur, largeurElementStructur, hauteurElementStructur, hauteurElementStructur);
+    parallelRows(image.rows, [&](int rowStart, int rowEnd) {
+        forEachPixelSplit(image.size(), extent, rowStart, rowEnd, border, interiorRow);
     });
 
     return res;
@@ -154,50 +1438,51 @@ Mat dilate(Mat image, Mat structuringElement)
 /**
     Compute the erosion of the input float image by the given structuring element.
     Pixel outside the image are supposed to have value 1.
+
+    Large rectangular structuring elements (including horizontal and vertical lines) are
+    processed with the van Herk/Gil-Werman algorithm, in constant time per pixel, and other
+    large shapes with the chord algorithm (see ChordTables).
 */
 Mat erode(Mat image, Mat structuringElement)
 {
     Mat res = image.clone();
 
-    int largeurElementStructur = (structuringElement.rows - 1) / 2;
-    int hauteurElementStructur = (structuringElement.cols - 1) / 2;
+    int largeurElementStructur = Erosion::radius(structuringElement.rows);
+    int hauteurElementStructur = Erosion::radius(structuringElement.cols);
+    CompiledStructuringElement se(structuringElement, largeurElementStructur, hauteurElementStructur);
+    const vector<Point> & offsets = se.offsets;
 
-    int ligne = 0;
-    while (ligne < image.rows)
-    {
-        int colonne = 0;
-        while (colonne < image.cols)
-        {
-            float valeurMinimumPixel = 1.0;
-
-            int x = -largeurElementStructur;
-            while (x <= largeurElementStructur)
-            {
-                int y = -hauteurElementStructur;
-                while (y <= hauteurElementStructur)
-                {
-                    if (structuringElement.at<float>(x + largeurElementStructur, y + hauteurElementStructur) == 1)
-                    {
-                        int ligneImage = ligne + x;
-                        int colonneImage = colonne + y;
-
-                        if (ligneImage >= 0 && ligneImage < image.rows && colonneImage >= 0 && colonneImage < image.cols)
-                        {
-                            float valeurPixel = image.at<float>(ligneImage, colonneImage);
-                            valeurMinimumPixel = std::min(valeurMinimumPixel, valeurPixel);
-                        }
-                    }
-                    y++;
-                }
-                x++;
-            }
+    Mat fast = sublinearMorphology<Erosion>(image, se);
+    if (!fast.empty())
+        return fast;
 
-            res.at<float>(ligne, colonne) = valeurMinimumPixel;
+    auto border = [&](int ligne, int colonne) {
+        float valeurMinimumPixel = 1.0;
+        for (const Point & offset : offsets) {
+            int ligneImage = ligne + offset.y;
+            int colonneImage = colonne + offset.x;
+            if (ligneImage >= 0 && ligneImage < image.rows && colonneImage >= 0 && colonneImage < image.cols)
+                valeurMinimumPixel = std::min(valeurMinimumPixel, image.at<float>(ligneImage, colonneImage));
+        }
+        res.at<float>(ligne, colonne) = valeurMinimumPixel;
+    };
 
-            colonne++;
+    auto interiorRow = [&](int ligne, int colonneStart, int colonneEnd) -> int {
+        float * out = res.ptr<float>(ligne);
+        int colonne = colonneStart;
+        for (; colonne + VFLOAT_WIDTH <= colonneEnd; colonne += VFLOAT_WIDTH) {
+            vfloat valeurMinimumPixel = vset(1.0f);
+            for (const Point & offset : offsets)
+                valeurMinimumPixel = vmin(valeurMinimumPixel, vload(image.ptr<float>(ligne + offset.y) + colonne + offset.x));
+            vstore(out + colonne, valeurMinimumPixel);
         }
-        ligne++;
-    }
+        return colonne;
+    };
+
+    NeighbourhoodExtent extent(largeurElementStructur, largeurElementStructur, hauteurElementStructur, hauteurElementStructur);
+    parallelRows(image.rows, [&](int rowStart, int rowEnd) {
+        forEachPixelSplit(image.size(), extent, rowStart, rowEnd, border, interiorRow);
+    });
 
     return res;
 }
@@ -205,6 +1490,8 @@ Mat erode(Mat image, Mat structuringElement)
 
 /**
     Compute the opening of the input float image by the given structuring element.
+
+    The erosion and the dilation are streamed row by row (see streamedComposition).
 */
 Mat open(Mat image, Mat structuringElement)
 {
@@ -214,14 +1501,15 @@ Mat open(Mat image, Mat structuringElement)
                 YOUR CODE HERE
         hint : 1 line of code is enough
     *********************************************/
-    Mat erosionIm = erode(image, structuringElement);
-    Mat res = dilate(erosionIm, structuringElement);
+    Mat res = streamedComposition<Erosion, Dilation>(image, structuringElement);
     return res;
 }
 
 
 /**
     Compute the closing of the input float image by the given structuring element.
+
+    The dilation and the erosion are streamed row by row (see streamedComposition).
 */
 Mat close(Mat image, Mat structuringElement)
 {
@@ -231,8 +1519,7 @@ Mat close(Mat image, Mat structuringElement)
                 YOUR CODE HERE
         hint : 1 line of code is enough
     *********************************************/
-    Mat dilatationIm = dilate(image, structuringElement);
-    Mat res = erode(dilatationIm, structuringElement);
+    Mat res = streamedComposition<Dilation, Erosion>(image, structuringElement);
     /********************************************
                 END OF YOUR CODE
     *********************************************/
@@ -242,6 +1529,10 @@ Mat close(Mat image, Mat structuringElement)
 
 /**
     Compute the morphological gradient of the input float image by the given structuring element.
+
+    The dilation and the erosion are computed by a single stream over the rows of the
+    image, which reads each row once for both and subtracts them row by row (see
+    gradientRowStream). Bands of rows are processed in parallel.
 */
 Mat morphologicalGradient(Mat image, Mat structuringElement)
 {
@@ -251,9 +1542,19 @@ Mat morphologicalGradient(Mat image, Mat structuringElement)
                 YOUR CODE HERE
         hint : 1 line of code is enough
     *********************************************/
-    Mat dilatationIm = dilate(image, structuringElement);
-    Mat erosionIm = erode(image, structuringElement);
-    res = dilatationIm - erosionIm;
+    CompiledStructuringElement dilationElement = compileStructuringElement<Dilation>(structuringElement);
+    CompiledStructuringElement erosionElement = compileStructuringElement<Erosion>(structuringElement);
+    res = Mat(image.size(), CV_32FC1);
+
+    parallelRows(image.rows, [&](int rowStart, int rowEnd) {
+        int sourceRow = std::max(rowStart + (dilationElement.box | erosionElement.box).y, 0);
+        ImageRowStream source(image, sourceRow);
+        std::unique_ptr<RowStream> gradient = gradientRowStream(source, dilationElement, erosionElement, image.size(), rowStart);
+        for (int y = rowStart; y < rowEnd; y++) {
+            const float * row = gradient->next();
+            std::copy(row, row + image.cols, res.ptr<float>(y));
+        }
+    }, dilationElement.box.height);
     /********************************************
                 END OF YOUR CODE
     *********************************************/
@@ -6,6 +6,8 @@
 
 cv::Mat median(cv::Mat image, int size);
 
+cv::Mat rankFilter(cv::Mat image, int size, float rank);
+
 cv::Mat erode(cv::Mat image, cv::Mat structuringElement);
 
 cv::Mat dilate(cv::Mat image, cv::Mat structuringElement);